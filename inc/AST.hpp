@@ -2,17 +2,66 @@
 #define AST_HPP
 
 
+#include<cstddef>
+#include<cstring>
 #include<string>
 #include<map>
 #include<vector>
 #include<llvm/Support/Casting.h>
 #include"APP.hpp"
+#include"symbol.hpp"
 //using namespace llvm;
 
 /************************************************
 AST
 ************************************************/
 
+/**
+  * ASTノード用アリーナの1ブロックのサイズとアラインメント
+  */
+#define AST_ARENA_BLOCK_SIZE (64*1024)
+#define AST_ARENA_ALIGN 8
+
+
+/**
+  * ASTノード用のアリーナ(バンプポインタ)
+  * ノードはデストラクタを持たず，アリーナの解放時にまとめて解放する
+  */
+class ASTArena{
+	private:
+		std::vector<char*> Blocks;
+		char *Cur;		//現在のブロックの空き領域の先頭
+		char *End;		//現在のブロックの末尾
+
+	public:
+		ASTArena():Cur(NULL), End(NULL){}
+		~ASTArena();
+		void *allocate(size_t size){
+			size=(size+AST_ARENA_ALIGN-1) & ~(size_t)(AST_ARENA_ALIGN-1);
+			if((size_t)(End-Cur)<size)
+				grow(size);
+			void *ptr=Cur;
+			Cur+=size;
+			return ptr;
+		}
+		template<typename T> T *copyArray(const std::vector<T> &vec, int begin=0){
+			int num=vec.size()-begin;
+			if(num<=0)
+				return NULL;
+			T *array=static_cast<T*>(allocate(sizeof(T)*num));
+			memcpy(array, &vec[begin], sizeof(T)*num);
+			return array;
+		}
+		void merge(ASTArena &other);
+
+	private:
+		void grow(size_t size);
+};
+
+inline void *operator new(size_t size, ASTArena &arena){return arena.allocate(size);}
+inline void operator delete(void *, ASTArena &){}
+
+
 /**
   * クラス宣言
   */
@@ -45,6 +94,18 @@ enum AstID{
 };
 
 
+/**
+  * 二項演算子の種類
+  */
+enum BinaryOp{
+	AssignOp,
+	AddOp,
+	SubOp,
+	MulOp,
+	DivOp
+};
+
+
 /**
   * ASTの基底クラス
   */
@@ -53,21 +114,23 @@ class BaseAST{
 
 	public:
 	BaseAST(AstID id):ID(id){}
-	virtual ~BaseAST(){}
 	AstID getValueID() const {return ID;}
 };
 
 
 /** 
   * ソースコードを表すAST
+  * 配下のノードは全てArenaに配置する
   */
 class TranslationUnitAST{
 	std::vector<PrototypeAST*> Prototypes;
 	std::vector<FunctionAST*> Functions;
+	ASTArena Arena;
 
 	public:
 		TranslationUnitAST(){}
-		~TranslationUnitAST();
+		~TranslationUnitAST(){}
+		ASTArena &getArena(){return Arena;}
 		bool addPrototype(PrototypeAST *proto);
 		bool addFunction(FunctionAST *func);
 		bool empty();
@@ -91,15 +154,18 @@ class TranslationUnitAST{
   * 関数宣言を表すAST
   */
 class PrototypeAST{
-	std::string Name;
-	std::vector<std::string> Params;
+	SymbolID Name;
+	SymbolID *Params;
+	int NumParams;
 
 	public:
-	PrototypeAST(const std::string &name, const std::vector<std::string> &params)
-		: Name(name), Params(params){}
-	std::string getName(){return Name;}
-	std::string getParamName(int i){if(i<Params.size())return Params.at(i);return NULL;}
-	int getParamNum(){return Params.size();}
+	PrototypeAST(ASTArena &arena, SymbolID name, const std::vector<SymbolID> &params, int begin=0)
+		: Name(name), Params(arena.copyArray(params, begin)), NumParams(params.size()-begin){}
+	const std::string &getName(){return getSymbolName(Name);}
+	SymbolID getSymbol(){return Name;}
+	const std::string &getParamName(int i){return getSymbolName(getParamSymbol(i));}
+	SymbolID getParamSymbol(int i){if(i<NumParams)return Params[i];return INVALID_SYMBOL;}
+	int getParamNum(){return NumParams;}
 };
 
 
@@ -111,8 +177,7 @@ class FunctionAST{
 	FunctionStmtAST *Body;
 	public:
 	FunctionAST(PrototypeAST *proto, FunctionStmtAST *body):Proto(proto), Body(body){}
-	~FunctionAST();
-	std::string getName(){return Proto->getName();}
+	const std::string &getName(){return Proto->getName();}
 	PrototypeAST *getPrototype(){return Proto;}
 	FunctionStmtAST *getBody(){return Body;}
 };
@@ -122,16 +187,18 @@ class FunctionAST{
   * 関数定義(本文)を表すAST
   */
 class FunctionStmtAST{
-	std::vector<VariableDeclAST*> VariableDecls;
-	std::vector<BaseAST*> StmtLists;
+	VariableDeclAST **VariableDecls;
+	int NumVariableDecls;
+	BaseAST **StmtLists;
+	int NumStmts;
 
 	public:
-	FunctionStmtAST(){}
-	~FunctionStmtAST();
-	bool addVariableDeclaration(VariableDeclAST *vdecl);
-	bool addStatement(BaseAST *stmt){StmtLists.push_back(stmt);}
-	VariableDeclAST *getVariableDecl(int i){if(i<VariableDecls.size())return VariableDecls.at(i);else return NULL;}
-	BaseAST *getStatement(int i){if(i<StmtLists.size())return StmtLists.at(i);else return NULL;}
+	FunctionStmtAST(ASTArena &arena, const std::vector<VariableDeclAST*> &vdecls, int vdecl_begin,
+			const std::vector<BaseAST*> &stmts, int stmt_begin)
+		: VariableDecls(arena.copyArray(vdecls, vdecl_begin)), NumVariableDecls(vdecls.size()-vdecl_begin),
+		StmtLists(arena.copyArray(stmts, stmt_begin)), NumStmts(stmts.size()-stmt_begin){}
+	VariableDeclAST *getVariableDecl(int i){if(i<NumVariableDecls)return VariableDecls[i];else return NULL;}
+	BaseAST *getStatement(int i){if(i<NumStmts)return StmtLists[i];else return NULL;}
 };
 
 
@@ -146,18 +213,18 @@ class VariableDeclAST: public BaseAST {
 		}DeclType;
 
 	private:
-		std::string Name;
+		SymbolID Name;
 		DeclType Type;
 	public:
-		VariableDeclAST(const std::string &name) : BaseAST(VariableDeclID), Name(name){
+		VariableDeclAST(SymbolID name) : BaseAST(VariableDeclID), Name(name){
 		}
 		static inline bool classof(VariableDeclAST const*){return true;}
 		static inline bool classof(BaseAST const* base){
 			return base->getValueID()==VariableDeclID;
 		}
-		~VariableDeclAST(){}
 		bool setDeclType(DeclType type){Type=type;return true;};
-		std::string getName(){return Name;}
+		const std::string &getName(){return getSymbolName(Name);}
+		SymbolID getSymbol(){return Name;}
 		DeclType getType(){return Type;}
 };
 
@@ -167,18 +234,17 @@ class VariableDeclAST: public BaseAST {
   * 二項演算を表すAST
   */
 class  BinaryExprAST : public BaseAST{
-	std::string Op;
+	BinaryOp Op;
 	BaseAST *LHS, *RHS;
 	public:
-	BinaryExprAST(std::string op, BaseAST *lhs, BaseAST *rhs)
+	BinaryExprAST(BinaryOp op, BaseAST *lhs, BaseAST *rhs)
 		: BaseAST(BinaryExprID), Op(op), LHS(lhs), RHS(rhs){
 		}
-	~BinaryExprAST(){SAFE_DELETE(LHS);SAFE_DELETE(RHS);}
 	static inline bool classof(BinaryExprAST const*){return true;}
 	static inline bool classof(BaseAST const* base){
 		return base->getValueID()==BinaryExprID;
 	}
-	std::string getOp(){return Op;}
+	BinaryOp getOp(){return Op;}
 	BaseAST *getLHS(){return LHS;}
 	BaseAST *getRHS(){return RHS;}
 };
@@ -201,15 +267,16 @@ class NullExprAST : public BaseAST{
   * 関数呼び出しを表すAST
   */
 class CallExprAST : public BaseAST{
-	std::string Callee;
-	std::vector<BaseAST*> Args;
+	SymbolID Callee;
+	BaseAST **Args;
+	int NumArgs;
 
 	public:
-	CallExprAST(const std::string &callee, std::vector<BaseAST*> &args)
-		: BaseAST(CallExprID), Callee(callee), Args(args){}
-	~CallExprAST();
-	std::string getCallee(){return Callee;}
-	BaseAST *getArgs(int i){if(i<Args.size())return Args.at(i);else return NULL;}
+	CallExprAST(ASTArena &arena, SymbolID callee, const std::vector<BaseAST*> &args, int begin=0)
+		: BaseAST(CallExprID), Callee(callee), Args(arena.copyArray(args, begin)), NumArgs(args.size()-begin){}
+	const std::string &getCallee(){return getSymbolName(Callee);}
+	SymbolID getCalleeSymbol(){return Callee;}
+	BaseAST *getArgs(int i){if(i<NumArgs)return Args[i];else return NULL;}
 	static inline bool classof(CallExprAST const*){return true;}
 	static inline bool classof(BaseAST const* base){
 		return base->getValueID()==CallExprID;
@@ -225,7 +292,6 @@ class JumpStmtAST : public BaseAST{
 	public:
 		JumpStmtAST(BaseAST *expr) : BaseAST(JumpStmtID), Expr(expr){
 		}
-		~JumpStmtAST(){SAFE_DELETE(Expr);}
 		BaseAST *getExpr(){return Expr;}
 		static inline bool classof(JumpStmtAST const*){return true;}
 		static inline bool classof(BaseAST const* base){
@@ -239,15 +305,15 @@ class JumpStmtAST : public BaseAST{
   */
 class VariableAST : public BaseAST{
 	//Name
-	std::string Name;
+	SymbolID Name;
 	public:
-	VariableAST(const std::string &name) : BaseAST(VariableID), Name(name){}
-	~VariableAST(){}
+	VariableAST(SymbolID name) : BaseAST(VariableID), Name(name){}
 	static inline bool classof(VariableAST const*){return true;}
 	static inline bool classof(BaseAST const* base){
 		return base->getValueID()==VariableID;
 	}
-	std::string getName(){return Name;}
+	const std::string &getName(){return getSymbolName(Name);}
+	SymbolID getSymbol(){return Name;}
 };
 
 
@@ -258,7 +324,6 @@ class NumberAST : public BaseAST {
 	int Val;
 	public:
 	NumberAST(int val) : BaseAST(NumberID), Val(val){};
-	~NumberAST(){}
 	int getNumberValue(){return Val;}
 	static inline bool classof(NumberAST const*){return true;}
 	static inline bool classof(BaseAST const* base){
@@ -267,4 +332,255 @@ class NumberAST : public BaseAST {
 };
 
 
+/************************************************
+FlatAST
+************************************************/
+
+/**
+  * FlatASTでのノード参照
+  * 上位4bitにAstID，下位28bitに種類ごとの配列の添字を持つ
+  */
+typedef unsigned int FlatRef;
+#define FLAT_REF(id, index) (((unsigned int)(id)<<28) | (unsigned int)(index))
+#define FLAT_ID(ref) ((AstID)((ref)>>28))
+#define FLAT_INDEX(ref) ((ref) & 0x0fffffffu)
+#define FLAT_INDEX_MAX 0x0fffffffu		//参照できる添字の最大値
+
+
+/**
+  * FlatASTの各ノード
+  * 子ノードはFlatRef，可変長の要素は共有配列の範囲(Begin, Num)で参照する
+  */
+struct FlatBinary{
+	BinaryOp Op;
+	FlatRef LHS;
+	FlatRef RHS;
+};
+
+struct FlatCall{
+	SymbolID Callee;
+	unsigned int ArgBegin;
+	unsigned int NumArgs;
+};
+
+struct FlatVariableDecl{
+	SymbolID Name;
+	VariableDeclAST::DeclType Type;
+};
+
+struct FlatPrototype{
+	SymbolID Name;
+	unsigned int ParamBegin;
+	unsigned int NumParams;
+};
+
+struct FlatFunction{
+	unsigned int Proto;		//Prototypesの添字
+	unsigned int DeclBegin;
+	unsigned int NumDecls;
+	unsigned int StmtBegin;
+	unsigned int NumStmts;
+};
+
+
+/**
+  * ノードを種類ごとの連続した配列に格納したAST
+  * 式のノードは親，左辺，右辺の順(前順)に格納するため，
+  * コード生成時の走査は各配列をほぼ先頭から順に読む
+  */
+class FlatAST{
+	private:
+		std::vector<FlatBinary> Binaries;
+		std::vector<FlatCall> Calls;
+		std::vector<FlatRef> Jumps;			//returnする式
+		std::vector<SymbolID> Variables;
+		std::vector<int> Numbers;
+		std::vector<FlatRef> Args;
+		std::vector<FlatVariableDecl> VariableDecls;
+		std::vector<FlatRef> Stmts;
+		std::vector<SymbolID> Params;
+		std::vector<FlatPrototype> Prototypes;	//関数宣言，関数定義のPrototypeの順
+		std::vector<FlatFunction> Functions;
+		int NumDeclarations;					//Prototypes中の関数宣言の数
+		bool Shared;							//関数内で同じ式のノードを共有している(DAG)
+		bool IndexOverflow;						//配列の添字がFLAT_INDEX_MAXを超えた(参照が壊れている)
+
+		//build()中の一時領域(入れ子の変換で積み重ね，確保済みの領域を使い回す)
+		std::vector<BinaryExprAST*> ChainStack;
+		std::vector<FlatRef> RefStack;
+
+	public:
+		FlatAST():NumDeclarations(0), Shared(false), IndexOverflow(false){}
+		~FlatAST(){}
+		bool build(TranslationUnitAST &tunit);
+		size_t getMemorySize();
+		bool empty(){return Prototypes.empty();}
+		bool isShared(){return Shared;}
+		bool hasIndexOverflow(){return IndexOverflow;}
+		bool save(std::string filename, unsigned long long source_hash);
+		bool load(std::string filename, unsigned long long source_hash);
+
+		int getDeclarationNum(){return NumDeclarations;}
+		const FlatPrototype &getDeclaration(int i){return Prototypes[i];}
+		int getFunctionNum(){return Functions.size();}
+		const FlatFunction &getFunction(int i){return Functions[i];}
+		const FlatPrototype &getPrototype(unsigned int i){return Prototypes[i];}
+		SymbolID getParam(unsigned int i){return Params[i];}
+		const FlatVariableDecl &getVariableDecl(unsigned int i){return VariableDecls[i];}
+		FlatRef getStatement(unsigned int i){return Stmts[i];}
+		FlatRef getArg(unsigned int i){return Args[i];}
+
+		const FlatBinary &getBinary(FlatRef ref){return Binaries[FLAT_INDEX(ref)];}
+		const FlatCall &getCall(FlatRef ref){return Calls[FLAT_INDEX(ref)];}
+		FlatRef getJumpExpr(FlatRef ref){return Jumps[FLAT_INDEX(ref)];}
+		SymbolID getVariable(FlatRef ref){return Variables[FLAT_INDEX(ref)];}
+		int getNumber(FlatRef ref){return Numbers[FLAT_INDEX(ref)];}
+
+		/**
+		  式の書き換え用(Simplifier, ExpressionSharer等)
+		  追加したノードは配列の末尾に置き，参照されなくなったノードは残す．
+		  添字がFLAT_INDEX_MAXを超えた場合はNullExprの参照を返し，hasIndexOverflow()をtrueにする
+		  */
+		FlatRef addNumber(int value);
+		FlatRef addVariable(SymbolID var);
+		FlatRef addBinary(BinaryOp op, FlatRef lhs, FlatRef rhs);
+		FlatRef addCall(SymbolID callee, const std::vector<FlatRef> &args, int begin=0);
+		FlatRef addJump(FlatRef expr);
+		void swapExpressions(FlatAST &other, bool shared);
+		void setBinary(FlatRef ref, BinaryOp op, FlatRef lhs, FlatRef rhs);
+		void setArg(unsigned int i, FlatRef arg){Args[i]=arg;}
+		void setJumpExpr(FlatRef ref, FlatRef expr){Jumps[FLAT_INDEX(ref)]=expr;}
+		void setStatement(unsigned int i, FlatRef stmt){Stmts[i]=stmt;}
+
+		/**
+		  関数本体の組み替え用(Inliner等)
+		  */
+		void swapStatements(std::vector<FlatVariableDecl> &decls, std::vector<FlatRef> &stmts);
+		void setFunction(int i, const FlatFunction &func){Functions[i]=func;}
+
+	private:
+		unsigned int addPrototype(PrototypeAST *proto);
+		FlatRef addExpression(BaseAST *expr);
+		FlatRef makeRef(AstID id, size_t index);
+		bool validate(unsigned int num_symbols);
+		bool isValidRef(FlatRef ref);
+		bool isAcyclic();
+		void remapSymbols(const std::vector<SymbolID> &remap);
+};
+
+
+/**
+  * FlatASTの式・文を辿るVisitor(CRTP)
+  * visitExpressionでノードの種類を1回だけ判定し，派生クラスのvisit*を呼ぶ．
+  * 派生クラスは必要なvisit*のみ定義する(既定では子ノードを辿ってRetTy()を返す)
+  */
+template<typename Derived, typename RetTy>
+class FlatASTVisitor{
+	protected:
+		FlatAST *AST;	//走査中のFlatAST
+
+	public:
+		FlatASTVisitor():AST(NULL){}
+		RetTy visitExpression(FlatRef ref){
+			switch(FLAT_ID(ref)){
+				case BinaryExprID:
+					return derived().visitBinaryExpression(ref, AST->getBinary(ref));
+				case CallExprID:
+					return derived().visitCallExpression(ref, AST->getCall(ref));
+				case JumpStmtID:
+					return derived().visitJumpStatement(ref, AST->getJumpExpr(ref));
+				case VariableID:
+					return derived().visitVariable(ref, AST->getVariable(ref));
+				case NumberID:
+					return derived().visitNumber(ref, AST->getNumber(ref));
+				default:
+					return derived().visitNullExpression(ref);
+			}
+		}
+
+	protected:
+		RetTy visitBinaryExpression(FlatRef, const FlatBinary &bin_expr){
+			derived().visitExpression(bin_expr.LHS);
+			derived().visitExpression(bin_expr.RHS);
+			return RetTy();
+		}
+		RetTy visitCallExpression(FlatRef, const FlatCall &call_expr){
+			for(int i=0; i<call_expr.NumArgs; i++)
+				derived().visitExpression(AST->getArg(call_expr.ArgBegin+i));
+			return RetTy();
+		}
+		RetTy visitJumpStatement(FlatRef, FlatRef expr){
+			derived().visitExpression(expr);
+			return RetTy();
+		}
+		RetTy visitVariable(FlatRef, SymbolID){return RetTy();}
+		RetTy visitNumber(FlatRef, int){return RetTy();}
+		RetTy visitNullExpression(FlatRef){return RetTy();}
+
+	private:
+		Derived &derived(){return *static_cast<Derived*>(this);}
+};
+
+
+/**
+  * 式のノード数を数えるVisitor
+  */
+class FlatNodeCounter : public FlatASTVisitor<FlatNodeCounter, int>{
+	friend class FlatASTVisitor<FlatNodeCounter, int>;
+
+	public:
+		FlatNodeCounter(FlatAST *ast){AST=ast;}
+
+	private:
+		int visitBinaryExpression(FlatRef, const FlatBinary &bin_expr){
+			//左結合の長い式で再帰が深くならないよう，左辺の二項演算の連なりは反復で辿る
+			int num=0;
+			const FlatBinary *bin=&bin_expr;
+			while(true){
+				num+=1+visitExpression(bin->RHS);
+				if(FLAT_ID(bin->LHS)!=BinaryExprID)
+					return num+visitExpression(bin->LHS);
+				bin=&AST->getBinary(bin->LHS);
+			}
+		}
+		int visitCallExpression(FlatRef, const FlatCall &call_expr){
+			int num=1;
+			for(int i=0; i<call_expr.NumArgs; i++)
+				num+=visitExpression(AST->getArg(call_expr.ArgBegin+i));
+			return num;
+		}
+		int visitJumpStatement(FlatRef, FlatRef expr){return 1+visitExpression(expr);}
+		int visitVariable(FlatRef, SymbolID){return 1;}
+		int visitNumber(FlatRef, int){return 1;}
+		int visitNullExpression(FlatRef){return 1;}
+};
+
+
+/**
+  * ASTキャッシュファイルの識別子と版数
+  * Flat*構造体の配置やFlatASTの配列を変えた場合はAST_CACHE_VERSIONを上げる
+  */
+#define AST_CACHE_MAGIC 0x41434344u		//"DCCA"
+#define AST_CACHE_VERSION 1
+#define AST_CACHE_SECTIONS 11
+
+
+/**
+  * ASTキャッシュファイルのヘッダ
+  * 後ろにFlatASTの各配列(8バイト境界に揃える)，識別子の文字列('\0'区切り)が続く
+  */
+struct ASTCacheHeader{
+	unsigned int Magic;
+	unsigned int Version;
+	unsigned long long SourceHash;				//ソースファイルのハッシュ値
+	unsigned int NumDeclarations;
+	unsigned int NumSymbols;					//シンボルIDの数
+	unsigned int SymbolBytes;					//識別子の文字列の合計バイト数
+	unsigned int Counts[AST_CACHE_SECTIONS];	//各配列の要素数
+};
+
+
+bool hashSourceFile(std::string filename, unsigned long long &hash);
+
+
 #endif
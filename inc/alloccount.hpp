@@ -0,0 +1,18 @@
+#ifndef ALLOCCOUNT_HPP
+#define ALLOCCOUNT_HPP
+
+#include<cstdio>
+#include<cstdlib>
+#include"APP.hpp"
+
+
+/**
+  * ヒープ確保の計測
+  * グローバルなoperator newを置き換え，計測中の確保回数とバイト数を数える
+  */
+void startAllocCounting();
+bool isAllocCounting();
+void reportAllocCount(const char *phase);
+
+
+#endif
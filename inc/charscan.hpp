@@ -0,0 +1,56 @@
+#ifndef CHARSCAN_HPP
+#define CHARSCAN_HPP
+
+#include<cstdio>
+#include<cstdlib>
+#include"APP.hpp"
+
+
+/**
+  * 文字種別走査の実装種別
+  */
+enum ScanMode{
+	SCAN_AUTO,		//実行環境で使える最速の実装
+	SCAN_SCALAR,	//1バイトずつ判定
+	SCAN_SSE2,		//16バイト単位で判定
+	SCAN_AVX2		//32バイト単位で判定
+};
+
+
+/**
+  * 字句解析用の文字種別走査関数群
+  * 各関数はindexから走査を始め，条件を満たさなくなった位置を返す
+  * lineを受け取る関数は読み飛ばした改行の数だけ*lineを加算する
+  */
+struct CharScanner{
+	int (*skipSpace)(const char *buf, int index, int length, int *line);
+	int (*skipAlnum)(const char *buf, int index, int length);
+	int (*skipDigit)(const char *buf, int index, int length);
+	int (*skipLine)(const char *buf, int index, int length);
+	int (*skipBlockComment)(const char *buf, int index, int length, int *line);
+};
+
+
+/**
+  * 1バイト単位の文字種別判定(Cロケールのisspace/isalpha/isalnum/isdigit相当)
+  */
+inline bool isSpaceChar(char c){
+	return c==' ' || (unsigned char)(c-'\t') <= '\r'-'\t';
+}
+inline bool isDigitChar(char c){
+	return (unsigned char)(c-'0') <= 9;
+}
+inline bool isAlphaChar(char c){
+	return (unsigned char)((c|0x20)-'a') <= 'z'-'a';
+}
+inline bool isAlnumChar(char c){
+	return isAlphaChar(c) || isDigitChar(c);
+}
+
+
+bool setScanMode(ScanMode mode);
+ScanMode getScanMode();
+const char *getScanModeName(ScanMode mode);
+const CharScanner &getCharScanner();
+
+#endif
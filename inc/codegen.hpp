@@ -8,6 +8,12 @@
 #include<string>
 #include<vector>
 #include<llvm/ADT/APInt.h>
+#include<llvm/ADT/DenseMap.h>
+#include<llvm/ADT/DenseSet.h>
+#include<llvm/ADT/SmallString.h>
+#include<llvm/ADT/SmallVector.h>
+#include<llvm/ADT/Twine.h>
+#include<llvm/CallingConv.h>
 #include<llvm/Constants.h>
 #include<llvm/ExecutionEngine/ExecutionEngine.h>
 #include<llvm/ExecutionEngine/JIT.h>
@@ -19,40 +25,89 @@
 #include<llvm/IRBuilder.h>
 #include<llvm/Support/IRReader.h>
 #include<llvm/MDBuilder.h>
+#include<llvm/Target/TargetOptions.h>
 #include<llvm/ValueSymbolTable.h>
 #include"APP.hpp"
 #include"AST.hpp"
+#include"purity.hpp"
 //using namespace llvm;
 
 
+/**
+  * メモ化する関数の呼び出し結果のキャッシュのエントリ数(2の冪，ビット数)，
+  * メモ化する関数の引数の数の上限
+  */
+#define MEMO_CACHE_BITS 10
+#define MEMO_MAX_PARAMS 4
+
+
 /**
   * コード生成クラス
+  * 式・文の生成はFlatASTVisitorのvisitExpressionから呼ばれる．
+  * 自身を末尾で呼び出すreturn(x+f(...)，x*f(...)の形を含む)は関数本体の先頭への分岐にし，
+  * 他の関数の末尾呼び出しはtail呼び出しにする．
+  * (DummyCには条件分岐が無いため，自己末尾呼び出しは終わらないループになる)
+  * メモ化を有効にすると，関数を呼び出す純粋な関数を引数をキーとするキャッシュを引く関数で包み，
+  * mainの終了時にキャッシュのヒット率を表示する
   */
-class CodeGen{
+class CodeGen : public FlatASTVisitor<CodeGen, llvm::Value*>{
+	friend class FlatASTVisitor<CodeGen, llvm::Value*>;
+
 	private:
 		llvm::Function *CurFunc;		//現在コード生成中のFunction
 		llvm::Module *Mod;				//生成したModule を格納
 		llvm::IRBuilder<> *Builder;	//LLVM-IRを生成するIRBuilder クラス
+		llvm::DenseMap<FlatRef, llvm::Value*> SharedValues;	//共有ノードの生成済みの値(関数ごと)
+		bool GuaranteedTailCalls;	//Module内で定義する関数をfastccにし，末尾呼び出しの除去を保証する
+		llvm::DenseSet<SymbolID> DefinedFunctions;	//Module内で定義する関数のシンボルID
+
+		//純粋な関数のメモ化用
+		bool Memoize;							//メモ化の有無
+		int NumPureFunctions;					//純粋な関数の数
+		llvm::DenseSet<SymbolID> MemoFunctions;	//メモ化する関数のシンボルID
+		llvm::Function *MemoReport;				//ヒット率を表示する関数(NULL：表示しない)
+		std::vector<SymbolID> MemoNames;		//メモ化した関数(生成順)
+		llvm::SmallVector<llvm::GlobalVariable*, 8> MemoHits;	//関数ごとのキャッシュのヒット回数
+		llvm::SmallVector<llvm::GlobalVariable*, 8> MemoCalls;	//関数ごとの呼び出し回数
+
+		//自己末尾呼び出しの除去用(関数ごと)
+		SymbolID CurFuncName;						//現在コード生成中の関数のシンボルID
+		llvm::SmallVector<llvm::AllocaInst*, 8> ParamAllocas;	//引数の変数(宣言順)
+		llvm::BasicBlock *TailBlock;				//自己末尾呼び出しの分岐先(NULL：分岐しない)
+		llvm::AllocaInst *TailAcc;					//x+f(...)，x*f(...)のxの累積値(NULL：累積しない)
+		BinaryOp TailAccOp;							//累積する演算
 
 	public:
 		CodeGen();
 		~CodeGen();
 		bool doCodeGen(TranslationUnitAST &tunit, std::string name, std::string link_file, bool with_jit);
+		bool doCodeGen(FlatAST &ast, std::string name, std::string link_file, bool with_jit);
 		llvm::Module &getModule();
+		void setGuaranteedTailCalls(bool guaranteed){GuaranteedTailCalls=guaranteed;}
+		void setMemoize(bool memoize){Memoize=memoize;}
+		int getPureFunctionNum(){return NumPureFunctions;}
+		int getMemoizedFunctionNum(){return MemoNames.size();}
 
 
 	private:
-		bool generateTranslationUnit(TranslationUnitAST &tunit, std::string name);
-		llvm::Function *generateFunctionDefinition(FunctionAST *func, llvm::Module *mod);
-		llvm::Function *generatePrototype(PrototypeAST *proto, llvm::Module *mod);
-		llvm::Value *generateFunctionStatement(FunctionStmtAST *func_stmt);
-		llvm::Value *generateVariableDeclaration(VariableDeclAST *vdecl);
-		llvm::Value *generateStatement(BaseAST *stmt);
-		llvm::Value *generateBinaryExpression(BinaryExprAST *bin_expr);
-		llvm::Value *generateCallExpression(CallExprAST *call_expr);
-		llvm::Value *generateJumpStatement(JumpStmtAST *jump_stmt);
-		llvm::Value *generateVariable(VariableAST *var);
-		llvm::Value *generateNumber(int value);
+		bool generateTranslationUnit(std::string name);
+		llvm::Function *generateFunctionDefinition(const FlatFunction &func, llvm::Module *mod);
+		llvm::Function *generatePrototype(const FlatPrototype &proto, llvm::Module *mod);
+		llvm::Value *generateFunctionStatement(const FlatFunction &func);
+		llvm::Value *generateVariableDeclaration(const FlatVariableDecl &vdecl);
+		llvm::Value *visitBinaryExpression(FlatRef ref, const FlatBinary &bin_expr);
+		llvm::Value *visitCallExpression(FlatRef ref, const FlatCall &call_expr);
+		llvm::Value *visitJumpStatement(FlatRef ref, FlatRef expr);
+		llvm::Value *visitVariable(FlatRef ref, SymbolID var);
+		llvm::Value *visitNumber(FlatRef ref, int value);
+		bool matchSelfTailCall(FlatRef expr, FlatRef &call, FlatRef &operand, BinaryOp &op);
+		bool isSelfCall(FlatRef expr);
+		bool isSafeOperand(FlatRef expr);
+		llvm::Value *generateSelfTailCall(FlatRef expr, FlatRef call, FlatRef operand, BinaryOp op);
+		llvm::Value *generateAccumulate(BinaryOp op, llvm::Value *lhs, llvm::Value *rhs);
+		void findMemoFunctions();
+		llvm::Function *generateMemoWrapper(llvm::Function *func);
+		void generateMemoReport();
 		bool linkModule(llvm::Module *dest, std::string file_name);
 };
 
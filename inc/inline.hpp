@@ -0,0 +1,71 @@
+#ifndef INLINE_HPP
+#define INLINE_HPP
+
+#include<cstdio>
+#include<cstdlib>
+#include<string>
+#include<vector>
+#include"APP.hpp"
+#include"AST.hpp"
+
+
+/**
+  * 展開する関数本体のノード数の上限(既定値)
+  */
+#define INLINE_THRESHOLD 40
+
+
+/**
+  * FlatASTの関数呼び出しのインライン展開クラス
+  * 関数呼び出しを含まず(葉関数)，最後の文のみがreturnで，ノード数が閾値以下の関数を
+  * 呼び出し元に展開する．引数と局所変数は呼び出し元の局所変数に改名し，
+  * 本体の文は呼び出しを含む文の前に置き，呼び出しはreturnする式で置き換える．
+  * 文の評価順を変えないよう，同じ文の中で代入や展開しない呼び出しより後に
+  * 評価される呼び出しは展開しない．関数は定義順に処理し，展開後に葉関数と
+  * なった関数はさらに後の関数へ展開できる
+  */
+class Inliner : public FlatASTVisitor<Inliner, FlatRef>{
+	friend class FlatASTVisitor<Inliner, FlatRef>;
+
+	private:
+		int Threshold;			//展開する関数本体のノード数の上限
+		int InlinedCalls;		//展開した呼び出しの数
+
+		//組み替え後の変数宣言と文，関数ごとの範囲
+		std::vector<FlatVariableDecl> Decls;
+		std::vector<FlatRef> Stmts;
+		std::vector<FlatFunction> Bodies;
+
+		std::vector<int> Callees;				//シンボルIDごとの展開できる関数(Bodiesの添字，-1は展開しない)
+		std::vector<SymbolID> Renames;			//展開中の関数の変数のシンボルID -> 改名後のシンボルID
+		std::vector<FlatRef> Substitutes;		//展開中の関数の引数のシンボルID -> 代わりに使う実引数
+		bool Hoistable;		//現在の文でここまでに副作用のある式を評価していない
+		bool HasCall;		//現在の関数に展開しない呼び出しが残っている
+
+		//左辺の二項演算の連なり(入れ子の展開・複製で積み重ね，確保済みの領域を使い回す)
+		std::vector<FlatRef> SpineStack;
+
+	public:
+		Inliner(int threshold=INLINE_THRESHOLD):Threshold(threshold), InlinedCalls(0){}
+		~Inliner(){}
+		void doInline(FlatAST &ast);
+		int getInlinedCalls(){return InlinedCalls;}
+
+	private:
+		FlatRef visitBinaryExpression(FlatRef ref, const FlatBinary &bin_expr);
+		FlatRef visitCallExpression(FlatRef ref, const FlatCall &call_expr);
+		FlatRef visitJumpStatement(FlatRef ref, FlatRef expr);
+		FlatRef visitVariable(FlatRef ref, SymbolID){return ref;}
+		FlatRef visitNumber(FlatRef ref, int){return ref;}
+		FlatRef visitNullExpression(FlatRef ref){return ref;}
+
+		FlatRef inlineCall(const FlatCall &call_expr, const FlatFunction &func);
+		FlatRef copyExpression(FlatRef expr);
+		FlatRef copyLeaf(FlatRef expr);
+		bool isInlinable(const FlatFunction &func);
+		bool isAssigned(FlatRef expr, SymbolID var);
+		SymbolID makeLocalName(SymbolID func_name, SymbolID var);
+};
+
+
+#endif
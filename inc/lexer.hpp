@@ -3,11 +3,12 @@
 	
 #include<cstdio>
 #include<cstdlib>
-#include<fstream>
 #include<list>
 #include<string>
 #include<vector>
 #include"APP.hpp"
+#include"charscan.hpp"
+#include"symbol.hpp"
 
 
 /**
@@ -16,86 +17,198 @@
 enum TokenType{
 	TOK_IDENTIFIER,	//識別子
 	TOK_DIGIT,			//数字
-	TOK_SYMBOL,			//記号
 	TOK_INT,				//INT
 	TOK_RETURN,			//RETURN
+	TOK_PLUS,			//'+'
+	TOK_MINUS,			//'-'
+	TOK_STAR,			//'*'
+	TOK_SLASH,			//'/'
+	TOK_ASSIGN,			//'='
+	TOK_SEMICOLON,		//';'
+	TOK_COMMA,			//','
+	TOK_LPAREN,			//'('
+	TOK_RPAREN,			//')'
+	TOK_LBRACE,			//'{'
+	TOK_RBRACE,			//'}'
 	TOK_EOF				//EOF
 };
 
 
+/**
+  * 字句解析対象のソースを保持するクラス
+  * ファイル全体をmmapし，一続きのバッファとして扱う
+  */
+class SourceBuffer{
+	private:
+		const char *Data;
+		size_t Size;
+		bool IsMapped;
+
+	public:
+		SourceBuffer():Data(NULL), Size(0), IsMapped(false){}
+		~SourceBuffer(){release();}
+		bool open(std::string filename);
+		void replace(int begin, int end, const std::string &text);
+		const char *getData(){return Data;}
+		size_t getSize(){return Size;}
+
+	private:
+		void release();
+};
+
+
 /**
   *個別トークン格納クラス
+  *字句はSourceBuffer中のオフセットと長さで参照する
+  *Valueは数字の場合は数値，識別子の場合はシンボルID
   */
 typedef class Token{
 	public:
 
 	private:
 	TokenType Type;
-	std::string TokenString;
-	int Number;
+	int Offset;
+	int Length;
+	int Value;
 	int Line;
 
 
 	public:
-	Token(std::string string, TokenType type, int line) 
-		: TokenString(string), Type(type), Line(line){
-		if(type == TOK_DIGIT)
-			Number = atoi(string.c_str());
-		else
-			Number = 0x7fffffff;
-	};
+	Token() 
+		: Type(TOK_EOF), Offset(0), Length(0), Value(0x7fffffff), Line(0){}
+	Token(TokenType type, int offset, int length, int line, int value=0x7fffffff) 
+		: Type(type), Offset(offset), Length(length), Value(value), Line(line){}
 	~Token(){};
 
 
-	TokenType getTokenType(){return Type;};
-	std::string getTokenString(){return TokenString;};
-	int getNumberValue(){return Number;};
+	TokenType getTokenType() const {return Type;};
+	int getOffset() const {return Offset;}
+	int getLength() const {return Length;}
+	int getValue() const {return Value;}
+	int getNumberValue() const {return Value;};
+	SymbolID getSymbol() const {return Value;}
 	bool setLine(int line){Line=line;return true;}
-	int getLine(){return Line;}
+	int getLine() const {return Line;}
 	
 }Token;
 
 
 
+/**
+  * 字句解析器
+  * SourceBufferを先頭から走査し，呼び出しごとにトークンを1つ切り出す
+  */
+class Lexer{
+	private:
+		const char *Buf;
+		int Length;
+		int Index;		//走査位置
+		int Begin;		//切り出し中のトークンの開始位置
+		int Line;		//行番号
+		int State;		//DFAの状態
+		const CharScanner *Scan;
+		SymbolInterner *Interner;
+		bool UseScanner;
+		bool Finished;
+		bool Error;
+
+	public:
+		Lexer(SourceBuffer *source);
+		Lexer(SourceBuffer *source, int begin, int end, int line, SymbolInterner *interner);
+		~Lexer(){}
+		bool lexToken(Token &token);
+		bool hasError(){return Error;}
+		void printError();
+};
+
+
+
 /**
   * 切り出したToken格納用クラス
+  * トークンは種別・オフセット・長さ・行番号・値の配列に分けて保持する
+  * 一括切り出し時は全トークンを保持する
+  * 逐次切り出し時はgetNextToken()に合わせてLexerから切り出し，
+  * 直近のトークンのみを各配列をリングバッファとして保持する
   */
 class TokenStream{
 	public:
 
 	private:
-		std::vector<Token*> Tokens;
+		SourceBuffer *Source;
+		bool OwnsSource;	//slice()で作成した場合は元のTokenStreamが所有
 		int CurIndex;
 
+		//トークン格納用配列
+		std::vector<unsigned char> Kinds;
+		std::vector<int> Offsets;
+		std::vector<int> Lengths;
+		std::vector<int> Lines;
+		std::vector<int> Values;
+
+		//逐次切り出し用
+		Lexer *Lex;
+		int WindowMask;
+		int NumLexed;		//切り出し済みトークン数
+		bool Error;
+
+		//後戻り(バックトラック)の計測用
+		int NumRewinds;		//後戻りした回数
+		int NumRewound;		//後戻りで再度読むことになったトークン数
+
+		//再字句解析用の行頭位置と，行頭がブロックコメント中か
+		std::vector<int> LineOffsets;
+		std::vector<unsigned char> LineInComment;
+
 	protected:
 
 	public:
-		TokenStream():CurIndex(0){}
+		TokenStream(SourceBuffer *source):Source(source), OwnsSource(true), CurIndex(0), Lex(NULL), WindowMask(-1), NumLexed(0), Error(false), NumRewinds(0), NumRewound(0){}
+		TokenStream(SourceBuffer *source, int window_size);
 		~TokenStream();
 
 
 		bool ungetToken(int Times=1);
 		bool getNextToken();
-		bool pushToken(Token *token){
-			Tokens.push_back(token);
+		TokenType peekType(int ahead=1);
+		bool pushToken(const Token &token){
+			Kinds.push_back(token.getTokenType());
+			Offsets.push_back(token.getOffset());
+			Lengths.push_back(token.getLength());
+			Lines.push_back(token.getLine());
+			Values.push_back(token.getValue());
+			NumLexed++;
 			return true;
 		}
 		Token getToken();
-		TokenType getCurType(){return Tokens[CurIndex]->getTokenType();}
-		std::string getCurString(){return Tokens[CurIndex]->getTokenString();}
-		int getCurNumVal(){return Tokens[CurIndex]->getNumberValue();}
+		const char *getTokenText(int index){return Source->getData()+Offsets[getSlot(index)];}
+		int getTokenLength(int index){return Lengths[getSlot(index)];}
+		TokenType getCurType(){return (TokenType)Kinds[getSlot(CurIndex)];}
+		int getCurNumVal(){return Values[getSlot(CurIndex)];}
+		SymbolID getCurSymbol(){return Values[getSlot(CurIndex)];}
+		int getCurLine(){return Lines[getSlot(CurIndex)];}
 		bool printTokens();
 		int getCurIndex(){return CurIndex;}
-		bool applyTokenIndex(int index){CurIndex=index;return true;}
+		bool applyTokenIndex(int index);
+		bool hasError(){return Error;}
+		int getRewindCount(){return NumRewinds;}
+		int getRewoundTokenCount(){return NumRewound;}
+		bool isLazy(){return Lex!=NULL;}
+		TokenStream *slice(int begin, int end, TokenStream *reuse=NULL);
+		bool relex(int begin, int end, const std::string &text);
 		
 		
 
 	private:
+		//トークン番号から配列の添字へ変換(一括切り出し時はWindowMask=-1)
+		int getSlot(int index){return index & WindowMask;}
+		bool lexNextToken();
+		bool checkWindow(int index);
+		void buildLineTable();
 
 	protected:
 
 
 };
 
-TokenStream *LexicalAnalysis(std::string input_filename);
+TokenStream *LexicalAnalysis(std::string input_filename, int window_size=0, int num_threads=1);
 #endif
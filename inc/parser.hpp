@@ -2,6 +2,7 @@
 #define PARSER_HPP
 
 #include<algorithm>
+#include<climits>
 #include<cstdio>
 #include<cstdlib>
 #include<map>
@@ -13,6 +14,18 @@
 //using namespace llvm;
 
 
+/**
+  * 並列構文解析の単位(関数定義1つ)
+  */
+struct FunctionItem{
+	PrototypeAST *Proto;
+	int Begin;			//function_statementの'{'のインデックス
+	int End;			//function_statementの'}'の次のインデックス
+	int Visible;		//定義の位置で参照できるグローバルな識別子の数
+	FunctionAST *Func;	//解析結果
+};
+
+
 /**
   * 構文解析・意味解析クラス
   */
@@ -22,16 +35,25 @@ typedef class Parser{
 	private:
 		TokenStream *Tokens;
 		TranslationUnitAST *TU;
+		ASTArena *Arena;	//ASTノードの配置先(通常はTUのアリーナ)
 
-		//意味解析用各種識別子表
-		std::vector<std::string> VariableTable;
-		std::map<std::string, int> PrototypeTable;
-		std::map<std::string, int> FunctionTable;
+		//意味解析用の識別子表(変数，関数宣言，関数定義を1つの表で管理)
+		ScopedSymbolTable Symbols;
+
+		//構文解析中の一時領域(入れ子の解析で積み重ね，確保済みの領域を使い回す)
+		std::vector<SymbolID> ParamStack;
+		std::vector<VariableDeclAST*> DeclStack;
+		std::vector<BaseAST*> NodeStack;
+
+		//並列構文解析用
+		int Threads;		//構文解析のスレッド数
+		int VisibleLimit;	//参照できるグローバルな識別子の数
 
 	protected:
 
 	public:
-		Parser(std::string filename);
+		Parser(std::string filename, int token_window=0, int num_threads=1);
+		Parser(TokenStream *tokens, int num_threads=1);
 		~Parser(){SAFE_DELETE(TU);SAFE_DELETE(Tokens);}
 		bool doParse();
 		TranslationUnitAST &getAST();
@@ -41,9 +63,11 @@ typedef class Parser{
 		  各種構文解析メソッド
 		  */
 		bool visitTranslationUnit();
+		bool visitTranslationUnitParallel();
 		bool visitExternalDeclaration(TranslationUnitAST *tunit);
-		PrototypeAST *visitFunctionDeclaration();
-		FunctionAST *visitFunctionDefinition();
+		PrototypeAST *visitFunctionDeclaration(PrototypeAST *proto);
+		FunctionAST *visitFunctionDefinition(PrototypeAST *proto);
+		FunctionAST *visitFunctionItem(FunctionItem &item, TokenStream *tokens);
 		PrototypeAST *visitPrototype();
 		FunctionStmtAST *visitFunctionStatement(PrototypeAST *proto);
 		VariableDeclAST *visitVariableDeclaration();
@@ -51,11 +75,18 @@ typedef class Parser{
 		BaseAST *visitExpressionStatement();
 		BaseAST *visitJumpStatement();
 		BaseAST *visitAssignmentExpression();
-		BaseAST *visitAdditiveExpression(BaseAST *lhs);
-		BaseAST *visitMultiplicativeExpression(BaseAST *lhs);
+		BaseAST *visitBinaryExpression(int min_prec);
 		BaseAST *visitPostfixExpression();
 		BaseAST *visitPrimaryExpression();
 
+		/**
+		  意味解析・並列構文解析用の補助メソッド
+		  */
+		bool checkFunctionDefinition(PrototypeAST *proto);
+		void declareFunction(PrototypeAST *proto);
+		int skipFunctionStatement();
+		ScopedSymbol *lookupSymbol(SymbolID id);
+		static void *parseFunctionChunk(void *arg);
 
 	protected:
 
@@ -0,0 +1,47 @@
+#ifndef PURITY_HPP
+#define PURITY_HPP
+
+#include<cstdio>
+#include<cstdlib>
+#include<vector>
+#include"APP.hpp"
+#include"AST.hpp"
+
+
+/**
+  * 関数の純粋性の解析クラス
+  * 呼び出しグラフの強連結成分を呼び出される側から順に求め，
+  * Module外の関数(printnum等)を呼び出し得ない関数を純粋とする．
+  * DummyCには大域変数が無いため，純粋な関数の値は引数のみで決まる
+  */
+class PurityAnalysis : public FlatASTVisitor<PurityAnalysis, int>{
+	friend class FlatASTVisitor<PurityAnalysis, int>;
+
+	private:
+		std::vector<int> FunctionIndex;			//シンボルID -> 関数の添字(-1：Module内で定義しない)
+
+		//呼び出しグラフ(関数iの呼び出し先はEdges[EdgeBegin[i]]からEdges[EdgeBegin[i+1]-1]，-1はModule外)
+		std::vector<unsigned int> EdgeBegin;
+		std::vector<int> Edges;
+
+		std::vector<char> Pure;			//関数ごとの純粋性
+		std::vector<char> Recursive;	//関数ごとの再帰(自身を呼び出し得る)
+		int NumPure;
+
+	public:
+		PurityAnalysis():NumPure(0){}
+		~PurityAnalysis(){}
+		void analyze(FlatAST &ast);
+		bool isPure(SymbolID name);
+		bool isRecursive(SymbolID name);
+		bool hasCalls(SymbolID name);
+		int getPureNum(){return NumPure;}
+
+	private:
+		int visitCallExpression(FlatRef ref, const FlatCall &call_expr);
+		void findComponents();
+		void classifyComponent(const std::vector<int> &members, const std::vector<int> &component, int id);
+};
+
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef SHARE_HPP
+#define SHARE_HPP
+
+#include<cstdio>
+#include<cstdlib>
+#include<vector>
+#include<llvm/ADT/DenseMap.h>
+#include"APP.hpp"
+#include"AST.hpp"
+
+
+/**
+  * 式のノードの共有(hash-consing)クラス
+  * 関数ごとに同じ形の数値，変数参照，二項演算(代入以外)を1つのノードにまとめ，
+  * 式の木をDAGにする．変数参照は代入を挟むと別のノードとする．
+  * 関数呼び出しは副作用を持ち得るため共有しない
+  */
+class ExpressionSharer : public FlatASTVisitor<ExpressionSharer, FlatRef>{
+	friend class FlatASTVisitor<ExpressionSharer, FlatRef>;
+
+	private:
+		FlatAST Out;	//共有後の式の格納先
+
+		//共有するノードの表(関数ごとに空にする)
+		llvm::DenseMap<unsigned long long, FlatRef> Numbers;			//値 -> ノード
+		llvm::DenseMap<unsigned long long, FlatRef> Variables;			//(代入回数, シンボルID) -> ノード
+		llvm::DenseMap<unsigned long long, FlatRef> Binaries[DivOp+1];	//演算子ごとの(左辺, 右辺) -> ノード
+		std::vector<unsigned int> Generations;							//シンボルIDごとの代入回数
+		std::vector<FlatRef> ArgStack;									//関数呼び出しの引数の一時領域
+
+		int SharedNodes;		//既存のノードで置き換えた参照の数
+		int SavedInstructions;	//コード生成で生成しなくなる命令の数
+		long SavedBytes;		//FlatASTの使用メモリの減少量
+
+	public:
+		ExpressionSharer():SharedNodes(0), SavedInstructions(0), SavedBytes(0){}
+		~ExpressionSharer(){}
+		void doShare(FlatAST &ast);
+		int getSharedNodes(){return SharedNodes;}
+		int getSavedInstructions(){return SavedInstructions;}
+		long getSavedBytes(){return SavedBytes;}
+
+	private:
+		FlatRef visitBinaryExpression(FlatRef ref, const FlatBinary &bin_expr);
+		FlatRef visitCallExpression(FlatRef ref, const FlatCall &call_expr);
+		FlatRef visitJumpStatement(FlatRef ref, FlatRef expr);
+		FlatRef visitVariable(FlatRef ref, SymbolID var);
+		FlatRef visitNumber(FlatRef ref, int value);
+		FlatRef visitNullExpression(FlatRef ref){return ref;}
+		FlatRef getVariableNode(SymbolID var, bool &found);
+		void clearTables();
+};
+
+
+#endif
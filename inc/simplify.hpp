@@ -0,0 +1,51 @@
+#ifndef SIMPLIFY_HPP
+#define SIMPLIFY_HPP
+
+#include<cstdio>
+#include<cstdlib>
+#include<vector>
+#include"APP.hpp"
+#include"AST.hpp"
+
+
+/**
+  * FlatASTの式の簡約クラス
+  * 定数の畳み込み，恒等式(x*1, x+0, x*0, x-x)の適用，定数項の結合を行う．
+  * 演算はLLVM-IRのi32と同じく2の補数で折り返す．
+  * 0除算とINT_MIN/-1は実行時の動作を変えないよう畳み込まない
+  */
+class Simplifier : public FlatASTVisitor<Simplifier, FlatRef>{
+	friend class FlatASTVisitor<Simplifier, FlatRef>;
+
+	private:
+		int RemovedNodes;	//簡約で減ったノード数
+
+		//左辺の二項演算の連なり(入れ子の簡約で積み重ね，確保済みの領域を使い回す)
+		std::vector<FlatRef> SpineStack;
+
+	public:
+		Simplifier():RemovedNodes(0){}
+		~Simplifier(){}
+		void doSimplify(FlatAST &ast);
+		int getRemovedNodes(){return RemovedNodes;}
+
+	private:
+		FlatRef visitBinaryExpression(FlatRef ref, const FlatBinary &bin_expr);
+		FlatRef visitCallExpression(FlatRef ref, const FlatCall &call_expr);
+		FlatRef visitJumpStatement(FlatRef ref, FlatRef expr);
+		FlatRef visitVariable(FlatRef ref, SymbolID){return ref;}
+		FlatRef visitNumber(FlatRef ref, int){return ref;}
+		FlatRef visitNullExpression(FlatRef ref){return ref;}
+
+		FlatRef simplifyAdditive(FlatRef ref, BinaryOp op, FlatRef lhs, FlatRef rhs);
+		FlatRef simplifyMultiply(FlatRef ref, FlatRef lhs, FlatRef rhs);
+		FlatRef simplifyDivide(FlatRef ref, FlatRef lhs, FlatRef rhs);
+		FlatRef makeBinary(FlatRef ref, BinaryOp op, FlatRef lhs, FlatRef rhs);
+		FlatRef makeConstantOperation(FlatRef ref, BinaryOp op, FlatRef term, int value);
+		void splitConstant(FlatRef expr, BinaryOp op, FlatRef &term, int &value);
+		bool isRemovable(FlatRef expr);
+		bool isSameExpression(FlatRef lhs, FlatRef rhs);
+};
+
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef SYMBOL_HPP
+#define SYMBOL_HPP
+
+#include<cstdio>
+#include<cstdlib>
+#include<string>
+#include<vector>
+#include"APP.hpp"
+
+
+/**
+  * 識別子のシンボルID
+  * 出現した識別子に0から順に振る連番
+  */
+typedef unsigned int SymbolID;
+#define INVALID_SYMBOL 0xffffffffu
+
+
+/**
+  * 識別子の文字列とシンボルIDを対応付けるクラス
+  * 同じ文字列には常に同じIDを返す
+  */
+class SymbolInterner{
+	private:
+		std::vector<std::string> Names;		//ID -> 文字列
+		std::vector<unsigned int> Hashes;	//ID -> ハッシュ値
+		std::vector<SymbolID> Buckets;		//オープンアドレス法のハッシュ表
+
+	public:
+		SymbolInterner();
+		~SymbolInterner(){}
+		SymbolID intern(const char *str, int length);
+		const std::string &getName(SymbolID id){return Names[id];}
+		int size(){return Names.size();}
+
+	private:
+		void grow();
+};
+
+
+/**
+  * ScopedSymbolTableに登録する識別子の種類(ビットの組み合わせ)
+  */
+#define SYMBOL_VARIABLE		0x1		//変数(引数，ローカル変数)
+#define SYMBOL_PROTOTYPE	0x2		//関数宣言済み
+#define SYMBOL_FUNCTION		0x4		//関数定義済み
+
+
+/**
+  * ScopedSymbolTableの1エントリ
+  */
+struct ScopedSymbol{
+	SymbolID Symbol;
+	unsigned int Flags;		//SYMBOL_*の組み合わせ
+	int Arity;				//関数の引数の数
+	int Depth;				//宣言したスコープの深さ
+	int Shadowed;			//同名で外側のスコープのエントリ(無い場合は-1)
+};
+
+
+/**
+  * 意味解析用のスコープ付き識別子表
+  * シンボルIDをキーにしたオープンアドレス法のハッシュ表から，
+  * 最も内側のエントリを1回の探索で引く
+  */
+class ScopedSymbolTable{
+	private:
+		std::vector<ScopedSymbol> Entries;	//宣言順のエントリ(スコープのスタック)
+		std::vector<int> ScopeMarks;		//各スコープ開始時のEntries数
+		std::vector<SymbolID> Keys;			//オープンアドレス法のハッシュ表
+		std::vector<int> Tops;				//Keysに対応する最も内側のエントリ
+		int NumKeys;
+
+	public:
+		ScopedSymbolTable();
+		~ScopedSymbolTable(){}
+		void pushScope(){ScopeMarks.push_back(Entries.size());}
+		void popScope();
+		int getDepth(){return ScopeMarks.size();}
+		int size(){return Entries.size();}
+		int getIndex(ScopedSymbol *sym){return sym-&Entries[0];}
+		bool declare(SymbolID id, unsigned int flags, int arity=0);
+		ScopedSymbol *lookup(SymbolID id){
+			int top=Tops[findSlot(id)];
+			return top<0 ? NULL : &Entries[top];
+		}
+
+	private:
+		int findSlot(SymbolID id);
+		void grow();
+};
+
+
+SymbolInterner &getInterner();
+SymbolID internSymbol(const char *str, int length);
+SymbolID internSymbol(const std::string &str);
+const std::string &getSymbolName(SymbolID id);
+
+#endif
@@ -1,19 +1,47 @@
 #include "AST.hpp"
+#include<algorithm>
+#include<cstdio>
+#include<cstdlib>
+#include<fcntl.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<unistd.h>
 
 
 /**
   * デストラクタ
+  * 配置した全ノードをまとめて解放する
   */
-TranslationUnitAST::~TranslationUnitAST(){
-	for(int i=0; i<Prototypes.size(); i++){
-		SAFE_DELETE(Prototypes[i]);
+ASTArena::~ASTArena(){
+	for(int i=0; i<Blocks.size(); i++){
+		SAFE_DELETEA(Blocks[i]);
 	}
-	Prototypes.clear();
+}
 
-	for(int i=0; i<Functions.size(); i++){
-		SAFE_DELETE(Functions[i]);
-	}
-	Functions.clear();
+
+/**
+  * ブロックの追加
+  * ブロックサイズを超える要求には専用のブロックを確保する
+  * @param 確保するサイズ
+  */
+void ASTArena::grow(size_t size){
+	size_t block_size=std::max<size_t>(size, AST_ARENA_BLOCK_SIZE);
+	Cur=new char[block_size];
+	End=Cur+block_size;
+	Blocks.push_back(Cur);
+}
+
+
+/**
+  * 他のアリーナのブロックを引き取る
+  * 並列構文解析で各スレッドのアリーナを翻訳単位のアリーナにまとめる
+  * @param 引き取り元のアリーナ(空になる)
+  */
+void ASTArena::merge(ASTArena &other){
+	Blocks.insert(Blocks.end(), other.Blocks.begin(), other.Blocks.end());
+	other.Blocks.clear();
+	other.Cur=NULL;
+	other.End=NULL;
 }
 
 
@@ -47,50 +75,670 @@ bool TranslationUnitAST::empty(){
 
 
 /**
-  * デストラクタ
+  * TranslationUnitASTからの変換
+  * @param 変換元のTranslationUnitAST
+  * @return 成功時：true　失敗時(ノード数がFLAT_INDEX_MAXを超えた)：false
   */
-FunctionAST::~FunctionAST(){
-	SAFE_DELETE(Proto);
-	SAFE_DELETE(Body);
+bool FlatAST::build(TranslationUnitAST &tunit){
+	//function declaration
+	for(int i=0; tunit.getPrototype(i); i++)
+		addPrototype(tunit.getPrototype(i));
+	NumDeclarations=Prototypes.size();
+
+	//function definition
+	std::vector<FlatRef> stmts;
+	for(int i=0; tunit.getFunction(i); i++){
+		FunctionAST *func=tunit.getFunction(i);
+		FunctionStmtAST *func_stmt=func->getBody();
+		FlatFunction flat_func;
+		flat_func.Proto=addPrototype(func->getPrototype());
+
+		flat_func.DeclBegin=VariableDecls.size();
+		for(int j=0; func_stmt->getVariableDecl(j); j++){
+			VariableDeclAST *vdecl=func_stmt->getVariableDecl(j);
+			FlatVariableDecl flat_vdecl;
+			flat_vdecl.Name=vdecl->getSymbol();
+			flat_vdecl.Type=vdecl->getType();
+			VariableDecls.push_back(flat_vdecl);
+		}
+		flat_func.NumDecls=VariableDecls.size()-flat_func.DeclBegin;
+
+		//文の式を先に変換し，文の並びは連続した範囲に格納する
+		stmts.clear();
+		for(int j=0; func_stmt->getStatement(j); j++)
+			stmts.push_back(addExpression(func_stmt->getStatement(j)));
+		flat_func.StmtBegin=Stmts.size();
+		flat_func.NumStmts=stmts.size();
+		Stmts.insert(Stmts.end(), stmts.begin(), stmts.end());
+
+		Functions.push_back(flat_func);
+	}
+	return !IndexOverflow;
 }
 
 
 /**
-  * デストラクタ
+  * Prototypeの追加
+  * @return Prototypesの添字
   */
-FunctionStmtAST::~FunctionStmtAST(){
-	//delete variable_declaration
-	for(int i=0; i<VariableDecls.size(); i++){
-		SAFE_DELETE(VariableDecls[i]);
+unsigned int FlatAST::addPrototype(PrototypeAST *proto){
+	FlatPrototype flat_proto;
+	flat_proto.Name=proto->getSymbol();
+	flat_proto.ParamBegin=Params.size();
+	flat_proto.NumParams=proto->getParamNum();
+	for(int i=0; i<proto->getParamNum(); i++)
+		Params.push_back(proto->getParamSymbol(i));
+	Prototypes.push_back(flat_proto);
+	return Prototypes.size()-1;
+}
+
+
+/**
+  * 式・文の追加
+  * 親のノードを子より先に確保する(前順)．
+  * 左結合の長い式で再帰が深くならないよう，左辺の二項演算子の連なりは反復で辿る
+  * @return 追加したノードの参照
+  */
+FlatRef FlatAST::addExpression(BaseAST *expr){
+	if(llvm::isa<BinaryExprAST>(expr)){
+		unsigned int first=Binaries.size();
+		int chain_begin=ChainStack.size();
+		while(BinaryExprAST *bin_expr=llvm::dyn_cast<BinaryExprAST>(expr)){
+			ChainStack.push_back(bin_expr);
+			Binaries.push_back(FlatBinary());
+			expr=bin_expr->getLHS();
+		}
+		FlatRef lhs=addExpression(expr);
+		for(int i=ChainStack.size()-1; i>=chain_begin; i--){
+			BinaryExprAST *bin_expr=ChainStack[i];
+			unsigned int index=first+(i-chain_begin);
+			FlatRef rhs=addExpression(bin_expr->getRHS());
+			Binaries[index].Op=bin_expr->getOp();
+			Binaries[index].LHS=lhs;
+			Binaries[index].RHS=rhs;
+			lhs=makeRef(BinaryExprID, index);
+		}
+		ChainStack.resize(chain_begin);
+		return lhs;
+
+	}else if(CallExprAST *call_expr=llvm::dyn_cast<CallExprAST>(expr)){
+		unsigned int index=Calls.size();
+		Calls.push_back(FlatCall());
+		int arg_begin=RefStack.size();
+		for(int i=0; call_expr->getArgs(i); i++)
+			RefStack.push_back(addExpression(call_expr->getArgs(i)));
+		Calls[index].Callee=call_expr->getCalleeSymbol();
+		Calls[index].ArgBegin=Args.size();
+		Calls[index].NumArgs=RefStack.size()-arg_begin;
+		Args.insert(Args.end(), RefStack.begin()+arg_begin, RefStack.end());
+		RefStack.resize(arg_begin);
+		return makeRef(CallExprID, index);
+
+	}else if(JumpStmtAST *jump_stmt=llvm::dyn_cast<JumpStmtAST>(expr)){
+		unsigned int index=Jumps.size();
+		Jumps.push_back(0);
+		Jumps[index]=addExpression(jump_stmt->getExpr());
+		return makeRef(JumpStmtID, index);
+
+	}else if(VariableAST *var=llvm::dyn_cast<VariableAST>(expr)){
+		Variables.push_back(var->getSymbol());
+		return makeRef(VariableID, Variables.size()-1);
+
+	}else if(NumberAST *num=llvm::dyn_cast<NumberAST>(expr)){
+		Numbers.push_back(num->getNumberValue());
+		return makeRef(NumberID, Numbers.size()-1);
 	}
-	VariableDecls.clear();
 
-	//delete statements
-	for(int i=0; i<StmtLists.size(); i++){
-		SAFE_DELETE(StmtLists[i]);
+	return FLAT_REF(NullExprID, 0);
+}
+
+
+/**
+  * ノードの参照の作成
+  * 添字がFLAT_INDEX_MAXを超えると他のノードの参照と重なるため，NullExprの参照を返す
+  * @param ノードの種類，種類ごとの配列の添字
+  * @return ノードの参照
+  */
+FlatRef FlatAST::makeRef(AstID id, size_t index){
+	if(index>FLAT_INDEX_MAX){
+		IndexOverflow=true;
+		return FLAT_REF(NullExprID, 0);
 	}
-	StmtLists.clear();
+	return FLAT_REF(id, index);
 }
 
 
 /**
-  * VariableDeclAST(変数宣言追加)メソッド
-  * @param  VariableDeclAST
-  * @retirm true
+  * 数値のノードの追加
+  * @return 追加したノードの参照
   */
-bool FunctionStmtAST::addVariableDeclaration(VariableDeclAST *vdecl){
-		VariableDecls.push_back(vdecl);
-		return true;
+FlatRef FlatAST::addNumber(int value){
+	Numbers.push_back(value);
+	return makeRef(NumberID, Numbers.size()-1);
 }
 
 
 /**
-  * デストラクタ
+  * 変数参照のノードの追加
+  * @return 追加したノードの参照
+  */
+FlatRef FlatAST::addVariable(SymbolID var){
+	Variables.push_back(var);
+	return makeRef(VariableID, Variables.size()-1);
+}
+
+
+/**
+  * 二項演算のノードの追加
+  * @return 追加したノードの参照
+  */
+FlatRef FlatAST::addBinary(BinaryOp op, FlatRef lhs, FlatRef rhs){
+	FlatBinary bin_expr;
+	bin_expr.Op=op;
+	bin_expr.LHS=lhs;
+	bin_expr.RHS=rhs;
+	Binaries.push_back(bin_expr);
+	return makeRef(BinaryExprID, Binaries.size()-1);
+}
+
+
+/**
+  * 関数呼び出しのノードの追加
+  * @param 呼び出す関数のシンボルID，引数の参照(begin以降)
+  * @return 追加したノードの参照
+  */
+FlatRef FlatAST::addCall(SymbolID callee, const std::vector<FlatRef> &args, int begin){
+	FlatCall call_expr;
+	call_expr.Callee=callee;
+	call_expr.ArgBegin=Args.size();
+	call_expr.NumArgs=args.size()-begin;
+	Args.insert(Args.end(), args.begin()+begin, args.end());
+	Calls.push_back(call_expr);
+	return makeRef(CallExprID, Calls.size()-1);
+}
+
+
+/**
+  * ジャンプ文のノードの追加
+  * @param returnする式の参照
+  * @return 追加したノードの参照
+  */
+FlatRef FlatAST::addJump(FlatRef expr){
+	Jumps.push_back(expr);
+	return makeRef(JumpStmtID, Jumps.size()-1);
+}
+
+
+/**
+  * 式のノードの配列を入れ替える
+  * 別のFlatASTに作り直した式で置き換える時に使う(文の参照は呼び出し側で書き換える)
+  * @param 入れ替え先，置き換え後の式がノードを共有しているか
+  */
+void FlatAST::swapExpressions(FlatAST &other, bool shared){
+	Binaries.swap(other.Binaries);
+	Calls.swap(other.Calls);
+	Jumps.swap(other.Jumps);
+	Variables.swap(other.Variables);
+	Numbers.swap(other.Numbers);
+	Args.swap(other.Args);
+	std::swap(Shared, other.Shared);
+	Shared=shared;
+	IndexOverflow=IndexOverflow || other.IndexOverflow;
+}
+
+
+/**
+  * 変数宣言と文の配列の入れ替え
+  * 入れ替え後はsetFunctionで各関数の範囲を設定し直す
+  * @param 入れ替える変数宣言，文の配列
+  */
+void FlatAST::swapStatements(std::vector<FlatVariableDecl> &decls, std::vector<FlatRef> &stmts){
+	VariableDecls.swap(decls);
+	Stmts.swap(stmts);
+}
+
+
+/**
+  * 二項演算のノードの書き換え
+  */
+void FlatAST::setBinary(FlatRef ref, BinaryOp op, FlatRef lhs, FlatRef rhs){
+	FlatBinary &bin_expr=Binaries[FLAT_INDEX(ref)];
+	bin_expr.Op=op;
+	bin_expr.LHS=lhs;
+	bin_expr.RHS=rhs;
+}
+
+
+/**
+  * 各配列の使用メモリ量(バイト)
+  */
+size_t FlatAST::getMemorySize(){
+	return Binaries.size()*sizeof(FlatBinary) + Calls.size()*sizeof(FlatCall) +
+		Jumps.size()*sizeof(FlatRef) + Variables.size()*sizeof(SymbolID) +
+		Numbers.size()*sizeof(int) + Args.size()*sizeof(FlatRef) +
+		VariableDecls.size()*sizeof(FlatVariableDecl) + Stmts.size()*sizeof(FlatRef) +
+		Params.size()*sizeof(SymbolID) + Prototypes.size()*sizeof(FlatPrototype) +
+		Functions.size()*sizeof(FlatFunction);
+}
+
+
+/**
+  * ファイル全体を読み取り専用でmmapする
+  * @param ファイル名，ファイルサイズの格納先
+  * @return 成功時：先頭アドレス　失敗時：NULL
+  */
+static const char *mapFile(std::string filename, size_t &size){
+	int fd=open(filename.c_str(), O_RDONLY);
+	if(fd<0)
+		return NULL;
+	struct stat st;
+	if(fstat(fd, &st)!=0 || st.st_size==0){
+		close(fd);
+		return NULL;
+	}
+	size=st.st_size;
+	void *addr=mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(addr==MAP_FAILED)
+		return NULL;
+	return (const char*)addr;
+}
+
+
+/**
+  * ソースファイルのハッシュ値(FNV-1a 64bit)
+  * ASTキャッシュのキーとして使う
+  * @param ファイル名，ハッシュ値の格納先
+  * @return 成功時：true　失敗時：false
+  */
+bool hashSourceFile(std::string filename, unsigned long long &hash){
+	size_t size;
+	const char *buf=mapFile(filename, size);
+	if(!buf)
+		return false;
+	hash=14695981039346656037ull;
+	for(size_t i=0; i<size; i++){
+		hash^=(unsigned char)buf[i];
+		hash*=1099511628211ull;
+	}
+	munmap((void*)buf, size);
+	return true;
+}
+
+
+/**
+  * 配列1つ分の書き込み(8バイト境界まで0で埋める)
+  */
+template<typename T>
+static bool writeSection(FILE *fp, const std::vector<T> &section){
+	static const char padding[8]={0};
+	size_t bytes=section.size()*sizeof(T);
+	if(bytes && fwrite(&section[0], 1, bytes, fp)!=bytes)
+		return false;
+	size_t pad=(8-bytes%8)%8;
+	return fwrite(padding, 1, pad, fp)==pad;
+}
+
+
+/**
+  * 配列1つ分の読み込み
+  * @param 読み込み位置(読んだ分進める)，終端，要素数，格納先
+  * @return 成功時：true　失敗時：false
+  */
+template<typename T>
+static bool readSection(const char *&cur, const char *end, unsigned int count, std::vector<T> &section){
+	size_t bytes=(size_t)count*sizeof(T);
+	size_t padded=(bytes+7)&~(size_t)7;
+	if((size_t)(end-cur)<padded)
+		return false;
+	section.resize(count);
+	if(bytes)
+		memcpy(&section[0], cur, bytes);
+	cur+=padded;
+	return true;
+}
+
+
+/**
+  * ASTキャッシュファイルへの書き出し
+  * 途中で失敗したファイルを読まないよう，一時ファイルに書いてから置き換える
+  * @param キャッシュファイル名，ソースファイルのハッシュ値
+  * @return 成功時：true　失敗時：false
+  */
+bool FlatAST::save(std::string filename, unsigned long long source_hash){
+	SymbolInterner &interner=getInterner();
+	ASTCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	header.Magic=AST_CACHE_MAGIC;
+	header.Version=AST_CACHE_VERSION;
+	header.SourceHash=source_hash;
+	header.NumDeclarations=NumDeclarations;
+	header.NumSymbols=interner.size();
+	for(int i=0; i<interner.size(); i++)
+		header.SymbolBytes+=interner.getName(i).size()+1;
+	header.Counts[0]=Binaries.size();
+	header.Counts[1]=Calls.size();
+	header.Counts[2]=Jumps.size();
+	header.Counts[3]=Variables.size();
+	header.Counts[4]=Numbers.size();
+	header.Counts[5]=Args.size();
+	header.Counts[6]=VariableDecls.size();
+	header.Counts[7]=Stmts.size();
+	header.Counts[8]=Params.size();
+	header.Counts[9]=Prototypes.size();
+	header.Counts[10]=Functions.size();
+
+	//同じソースを同時にコンパイルするプロセスと一時ファイルが重ならないよう，名前はmkstempで決める
+	std::vector<char> tmp_name(filename.begin(), filename.end());
+	const char suffix[]=".XXXXXX";
+	tmp_name.insert(tmp_name.end(), suffix, suffix+sizeof(suffix));
+	int fd=mkstemp(&tmp_name[0]);
+	if(fd<0)
+		return false;
+	fchmod(fd, 0644);	//mkstempは所有者のみ読み書きできるファイルを作る
+	FILE *fp=fdopen(fd, "wb");
+	if(!fp){
+		close(fd);
+		remove(&tmp_name[0]);
+		return false;
+	}
+	bool ok=fwrite(&header, sizeof(header), 1, fp)==1 &&
+		writeSection(fp, Binaries) && writeSection(fp, Calls) &&
+		writeSection(fp, Jumps) && writeSection(fp, Variables) &&
+		writeSection(fp, Numbers) && writeSection(fp, Args) &&
+		writeSection(fp, VariableDecls) && writeSection(fp, Stmts) &&
+		writeSection(fp, Params) && writeSection(fp, Prototypes) &&
+		writeSection(fp, Functions);
+	for(int i=0; ok && i<interner.size(); i++){
+		const std::string &name=interner.getName(i);
+		ok=fwrite(name.c_str(), 1, name.size()+1, fp)==name.size()+1;
+	}
+	if(fclose(fp)!=0)
+		ok=false;
+	if(!ok || rename(&tmp_name[0], filename.c_str())!=0){
+		remove(&tmp_name[0]);
+		return false;
+	}
+	return true;
+}
+
+
+/**
+  * ASTキャッシュファイルからの読み込み
+  * 各配列はmmapした領域からそのままコピーする．
+  * 識別子は保存時の順に登録し直し，シンボルIDがずれた場合のみ振り直す
+  * @param キャッシュファイル名，ソースファイルのハッシュ値
+  * @return 成功時：true　失敗時(ファイルが無い，版数やハッシュ値が違う)：false
   */
-CallExprAST::~CallExprAST(){
+bool FlatAST::load(std::string filename, unsigned long long source_hash){
+	size_t size;
+	const char *buf=mapFile(filename, size);
+	if(!buf)
+		return false;
+	const char *end=buf+size;
+
+	ASTCacheHeader header;
+	if(size<sizeof(header)){
+		munmap((void*)buf, size);
+		return false;
+	}
+	memcpy(&header, buf, sizeof(header));
+	if(header.Magic!=AST_CACHE_MAGIC || header.Version!=AST_CACHE_VERSION ||
+			header.SourceHash!=source_hash){
+		munmap((void*)buf, size);
+		return false;
+	}
+
+	const char *cur=buf+sizeof(header);
+	const unsigned int *counts=header.Counts;
+	bool ok=readSection(cur, end, counts[0], Binaries) &&
+		readSection(cur, end, counts[1], Calls) &&
+		readSection(cur, end, counts[2], Jumps) &&
+		readSection(cur, end, counts[3], Variables) &&
+		readSection(cur, end, counts[4], Numbers) &&
+		readSection(cur, end, counts[5], Args) &&
+		readSection(cur, end, counts[6], VariableDecls) &&
+		readSection(cur, end, counts[7], Stmts) &&
+		readSection(cur, end, counts[8], Params) &&
+		readSection(cur, end, counts[9], Prototypes) &&
+		readSection(cur, end, counts[10], Functions) &&
+		(size_t)(end-cur)>=header.SymbolBytes;
+	NumDeclarations=header.NumDeclarations;
+
+	//識別子の登録
+	std::vector<SymbolID> remap;
+	bool need_remap=false;
+	for(unsigned int i=0; ok && i<header.NumSymbols; i++){
+		const char *name_end=(const char*)memchr(cur, '\0', end-cur);
+		if(!name_end){
+			ok=false;
+			break;
+		}
+		SymbolID id=internSymbol(cur, name_end-cur);
+		remap.push_back(id);
+		if(id!=i)
+			need_remap=true;
+		cur=name_end+1;
+	}
+	munmap((void*)buf, size);
+
+	if(!ok || !validate(header.NumSymbols)){
+		*this=FlatAST();
+		return false;
+	}
+	if(need_remap)
+		remapSymbols(remap);
+	return true;
+}
+
+
+/**
+  * 範囲が配列に収まるか
+  * @param 先頭の添字，要素数，配列の要素数
+  * @return 収まる：true　はみ出す：false
+  */
+static bool isInRange(unsigned int begin, unsigned int num, size_t size){
+	return begin<=size && num<=size-begin;
+}
+
+
+/**
+  * 子ノードが親より後ろにあるか
+  * build()は親を子より先に確保する(前順)ため，同じ配列の子は親より大きい添字を持つ
+  * @param 子ノードの参照，親ノードの種類，親ノードの添字
+  * @return 親と別の種類か，親より後ろ：true　それ以外：false
+  */
+static bool isAfter(FlatRef child, AstID parent_id, unsigned int parent_index){
+	return FLAT_ID(child)!=parent_id || FLAT_INDEX(child)>parent_index;
+}
+
+
+/**
+  * 読み込んだ配列の検査
+  * シンボルID，式の参照，各範囲が配列に収まり，式の参照が前順で循環しないことを確かめ，
+  * 壊れたキャッシュファイルで範囲外を読んだり，走査が終わらなくなったりしないようにする
+  * @param 保存時の識別子の数
+  * @return 正しい：true　不正：false
+  */
+bool FlatAST::validate(unsigned int num_symbols){
+	if(NumDeclarations<0 || NumDeclarations>Prototypes.size())
+		return false;
+
+	for(int i=0; i<Binaries.size(); i++){
+		const FlatBinary &bin=Binaries[i];
+		if(bin.Op<AssignOp || bin.Op>DivOp || !isValidRef(bin.LHS) || !isValidRef(bin.RHS))
+			return false;
+		//assignment (lhs is variable)
+		if(bin.Op==AssignOp && FLAT_ID(bin.LHS)!=VariableID)
+			return false;
+		if(!isAfter(bin.LHS, BinaryExprID, i) || !isAfter(bin.RHS, BinaryExprID, i))
+			return false;
+	}
+	for(int i=0; i<Calls.size(); i++){
+		const FlatCall &call=Calls[i];
+		if(call.Callee>=num_symbols || !isInRange(call.ArgBegin, call.NumArgs, Args.size()))
+			return false;
+		for(unsigned int j=0; j<call.NumArgs; j++){
+			if(!isAfter(Args[call.ArgBegin+j], CallExprID, i))
+				return false;
+		}
+	}
+	for(int i=0; i<Jumps.size(); i++){
+		if(!isValidRef(Jumps[i]) || !isAfter(Jumps[i], JumpStmtID, i))
+			return false;
+	}
+	for(int i=0; i<Variables.size(); i++){
+		if(Variables[i]>=num_symbols)
+			return false;
+	}
 	for(int i=0; i<Args.size(); i++){
-		SAFE_DELETE(Args[i]);
+		if(!isValidRef(Args[i]))
+			return false;
 	}
+	for(int i=0; i<VariableDecls.size(); i++){
+		const FlatVariableDecl &vdecl=VariableDecls[i];
+		if(vdecl.Name>=num_symbols ||
+				(vdecl.Type!=VariableDeclAST::param && vdecl.Type!=VariableDeclAST::local))
+			return false;
+	}
+	for(int i=0; i<Stmts.size(); i++){
+		if(!isValidRef(Stmts[i]))
+			return false;
+	}
+	for(int i=0; i<Params.size(); i++){
+		if(Params[i]>=num_symbols)
+			return false;
+	}
+	for(int i=0; i<Prototypes.size(); i++){
+		const FlatPrototype &proto=Prototypes[i];
+		if(proto.Name>=num_symbols ||
+				!isInRange(proto.ParamBegin, proto.NumParams, Params.size()))
+			return false;
+	}
+	for(int i=0; i<Functions.size(); i++){
+		const FlatFunction &func=Functions[i];
+		if(func.Proto>=Prototypes.size() ||
+				!isInRange(func.DeclBegin, func.NumDecls, VariableDecls.size()) ||
+				!isInRange(func.StmtBegin, func.NumStmts, Stmts.size()))
+			return false;
+	}
+	return isAcyclic();
 }
 
 
+/**
+  * 式・文の参照が循環していないか
+  * 種類の異なるノードを経由する循環(二項演算 -> 関数呼び出し -> 二項演算等)を，
+  * 明示的なスタックを使った深さ優先探索で調べる
+  * @return 循環が無い：true　循環がある：false
+  */
+bool FlatAST::isAcyclic(){
+	//子を持つノードの状態(0：未訪問，1：探索中，2：探索済み)
+	//Binaries，Calls，Jumpsの順に番号を振る
+	unsigned int call_base=Binaries.size();
+	unsigned int jump_base=call_base+Calls.size();
+	std::vector<char> state(jump_base+Jumps.size(), 0);
+	std::vector<std::pair<FlatRef, unsigned int> > path;	//探索中のノードと次に辿る子
+
+	for(unsigned int root=0; root<state.size(); root++){
+		if(state[root])
+			continue;
+		FlatRef root_ref;
+		if(root<call_base)
+			root_ref=FLAT_REF(BinaryExprID, root);
+		else if(root<jump_base)
+			root_ref=FLAT_REF(CallExprID, root-call_base);
+		else
+			root_ref=FLAT_REF(JumpStmtID, root-jump_base);
+		state[root]=1;
+		path.push_back(std::make_pair(root_ref, 0u));
+
+		while(!path.empty()){
+			FlatRef node=path.back().first;
+			unsigned int next=path.back().second++;
+			unsigned int index=FLAT_INDEX(node);
+			FlatRef child;
+			bool has_child;
+			unsigned int slot;
+			if(FLAT_ID(node)==BinaryExprID){
+				has_child=(next<2);
+				child=(next==0) ? Binaries[index].LHS : Binaries[index].RHS;
+				slot=index;
+			}else if(FLAT_ID(node)==CallExprID){
+				has_child=(next<Calls[index].NumArgs);
+				child=has_child ? Args[Calls[index].ArgBegin+next] : 0;
+				slot=call_base+index;
+			}else{
+				has_child=(next<1);
+				child=Jumps[index];
+				slot=jump_base+index;
+			}
+			if(!has_child){
+				state[slot]=2;
+				path.pop_back();
+				continue;
+			}
+
+			unsigned int child_slot;
+			if(FLAT_ID(child)==BinaryExprID)
+				child_slot=FLAT_INDEX(child);
+			else if(FLAT_ID(child)==CallExprID)
+				child_slot=call_base+FLAT_INDEX(child);
+			else if(FLAT_ID(child)==JumpStmtID)
+				child_slot=jump_base+FLAT_INDEX(child);
+			else
+				continue;
+			if(state[child_slot]==1)
+				return false;
+			if(state[child_slot]==0){
+				state[child_slot]=1;
+				path.push_back(std::make_pair(child, 0u));
+			}
+		}
+	}
+	return true;
+}
+
+
+/**
+  * 式・文の参照が正しいか
+  * @param 式・文の参照
+  * @return 既知の種類で，添字が対応する配列に収まる：true　それ以外：false
+  */
+bool FlatAST::isValidRef(FlatRef ref){
+	unsigned int index=FLAT_INDEX(ref);
+	switch(FLAT_ID(ref)){
+		case BinaryExprID:
+			return index<Binaries.size();
+		case NullExprID:
+			return true;
+		case CallExprID:
+			return index<Calls.size();
+		case JumpStmtID:
+			return index<Jumps.size();
+		case VariableID:
+			return index<Variables.size();
+		case NumberID:
+			return index<Numbers.size();
+		default:
+			return false;
+	}
+}
+
+
+/**
+  * シンボルIDの振り直し
+  * @param 保存時のシンボルID -> 現在のシンボルID
+  */
+void FlatAST::remapSymbols(const std::vector<SymbolID> &remap){
+	for(int i=0; i<Calls.size(); i++)
+		Calls[i].Callee=remap[Calls[i].Callee];
+	for(int i=0; i<Variables.size(); i++)
+		Variables[i]=remap[Variables[i]];
+	for(int i=0; i<VariableDecls.size(); i++)
+		VariableDecls[i].Name=remap[VariableDecls[i].Name];
+	for(int i=0; i<Params.size(); i++)
+		Params[i]=remap[Params[i]];
+	for(int i=0; i<Prototypes.size(); i++)
+		Prototypes[i].Name=remap[Prototypes[i].Name];
+}
@@ -0,0 +1,101 @@
+#include "alloccount.hpp"
+#include<cstdio>
+#include<cstdlib>
+#include<new>
+
+
+/**
+  * 計測状態(並列構文解析のスレッドからも加算する)
+  */
+static volatile bool Counting=false;
+static volatile unsigned long NumAllocs=0;
+static volatile unsigned long NumBytes=0;
+static unsigned long ReportedAllocs=0;
+static unsigned long ReportedBytes=0;
+
+
+/**
+  * operator newの例外指定(C++11以降は動的例外指定が使えない)
+  */
+#if __cplusplus >= 201103L
+#define ALLOC_THROW
+#define ALLOC_NOTHROW noexcept
+#else
+#define ALLOC_THROW throw(std::bad_alloc)
+#define ALLOC_NOTHROW throw()
+#endif
+
+
+/**
+  * 確保本体
+  */
+static void *countedAlloc(size_t size){
+	if(Counting){
+		__sync_fetch_and_add(&NumAllocs, 1);
+		__sync_fetch_and_add(&NumBytes, size);
+	}
+	void *ptr=malloc(size ? size : 1);
+	if(!ptr){
+		//LLVMと同じく例外は使わない
+		fprintf(stderr, "メモリを確保できません\n");
+		abort();
+	}
+	return ptr;
+}
+
+
+void *operator new(size_t size) ALLOC_THROW{
+	return countedAlloc(size);
+}
+void *operator new[](size_t size) ALLOC_THROW{
+	return countedAlloc(size);
+}
+void operator delete(void *ptr) ALLOC_NOTHROW{
+	free(ptr);
+}
+void operator delete[](void *ptr) ALLOC_NOTHROW{
+	free(ptr);
+}
+#if __cplusplus >= 201402L
+//サイズ付き解放(C++14以降)
+void operator delete(void *ptr, size_t) ALLOC_NOTHROW{
+	free(ptr);
+}
+void operator delete[](void *ptr, size_t) ALLOC_NOTHROW{
+	free(ptr);
+}
+#endif
+
+
+/**
+  * 計測開始
+  */
+void startAllocCounting(){
+	ReportedAllocs=NumAllocs;
+	ReportedBytes=NumBytes;
+	Counting=true;
+}
+
+
+/**
+  * 計測中か
+  */
+bool isAllocCounting(){
+	return Counting;
+}
+
+
+/**
+  * 前回の表示(または計測開始)からの確保回数とバイト数を表示
+  * @param 段階名
+  */
+void reportAllocCount(const char *phase){
+	if(!Counting)
+		return;
+	unsigned long allocs=NumAllocs;
+	unsigned long bytes=NumBytes;
+	fprintf(stderr, "allocs %-10s : %10lu allocs %12lu bytes\n", phase,
+			allocs-ReportedAllocs, bytes-ReportedBytes);
+	ReportedAllocs=allocs;
+	ReportedBytes=bytes;
+}
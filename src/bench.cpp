@@ -0,0 +1,218 @@
+#include "llvm/LLVMContext.h"
+#include "llvm/Module.h"
+#include "llvm/PassManager.h"
+#include "llvm/LinkAllPasses.h"
+#include<algorithm>
+#include<cstring>
+#include<time.h>
+#include "lexer.hpp"
+#include "AST.hpp"
+#include "parser.hpp"
+#include "simplify.hpp"
+#include "codegen.hpp"
+
+
+/**
+  * 計測前に捨てる実行回数，計測回数(既定値)
+  */
+#define BENCH_WARMUP 3
+#define BENCH_SAMPLES 30
+
+
+/**
+ * 時刻取得(マイクロ秒)
+ */
+static double getTime(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e6 + ts.tv_nsec*1e-3;
+}
+
+
+/**
+  * 1段階分の計測結果格納クラス
+  */
+class BenchResult{
+	private:
+		std::vector<double> Samples;
+		int Rewinds;		//1回あたりのトークンの後戻り回数
+		int RewoundTokens;	//1回あたりの後戻りで再度読んだトークン数
+
+	public:
+		BenchResult():Rewinds(0), RewoundTokens(0){}
+		void addSample(double usec){Samples.push_back(usec);}
+		void setRewinds(int rewinds, int tokens){Rewinds=rewinds;RewoundTokens=tokens;}
+		double getPercentile(double ratio);
+		void print(std::string input, std::string stage);
+};
+
+
+/**
+  * 計測値のパーセンタイル(nearest-rank)
+  * @param 割合(0.5で中央値)
+  * @return 計測値(マイクロ秒)
+  */
+double BenchResult::getPercentile(double ratio){
+	if(Samples.empty())
+		return 0;
+	std::vector<double> sorted(Samples);
+	std::sort(sorted.begin(), sorted.end());
+	int rank=(int)(ratio*sorted.size()+0.999999);
+	return sorted[std::max(rank, 1)-1];
+}
+
+
+/**
+  * 計測結果を1行で表示
+  * 入力名，段階，計測回数，中央値，95パーセンタイル，後戻り回数，後戻りトークン数をタブ区切りで出力する
+  */
+void BenchResult::print(std::string input, std::string stage){
+	fprintf(stdout, "%s\t%s\t%d\t%.2f\t%.2f\t%d\t%d\n", input.c_str(), stage.c_str(),
+			(int)Samples.size(), getPercentile(0.5), getPercentile(0.95), Rewinds, RewoundTokens);
+}
+
+
+/**
+  * 字句解析(LexicalAnalysis)の計測
+  * @param 入力ファイル名，計測回数，結果の格納先
+  * @return 成功時：true　失敗時：false
+  */
+static bool benchLexer(std::string filename, int samples, BenchResult &result){
+	for(int i=0; i<BENCH_WARMUP+samples; i++){
+		double start=getTime();
+		TokenStream *tokens=LexicalAnalysis(filename);
+		double elapsed=getTime()-start;
+		if(!tokens)
+			return false;
+		if(i>=BENCH_WARMUP)
+			result.addSample(elapsed);
+		SAFE_DELETE(tokens);
+	}
+	return true;
+}
+
+
+/**
+  * 構文解析(Parser::doParse)の計測
+  * 字句解析は計測に含めない．トークンの後戻りの回数も記録する
+  * @param 入力ファイル名，計測回数，結果の格納先
+  * @return 成功時：true　失敗時：false
+  */
+static bool benchParser(std::string filename, int samples, BenchResult &result){
+	for(int i=0; i<BENCH_WARMUP+samples; i++){
+		TokenStream *tokens=LexicalAnalysis(filename);
+		if(!tokens)
+			return false;
+		Parser *parser=new Parser(tokens);
+
+		double start=getTime();
+		bool parsed=parser->doParse();
+		double elapsed=getTime()-start;
+		result.setRewinds(tokens->getRewindCount(), tokens->getRewoundTokenCount());
+		SAFE_DELETE(parser);
+		if(!parsed)
+			return false;
+		if(i>=BENCH_WARMUP)
+			result.addSample(elapsed);
+	}
+	return true;
+}
+
+
+/**
+  * FlatASTへの変換(FlatAST::build)，式の簡約(Simplifier)，
+  * コード生成(CodeGen::doCodeGen)とmem2reg(PassManager)の計測
+  * 構文解析は1回のみ行い，ASTを使い回す
+  * @param 入力ファイル名，計測回数，変換・簡約・コード生成・mem2regの結果の格納先
+  * @return 成功時：true　失敗時：false
+  */
+static bool benchCodeGen(std::string filename, int samples, BenchResult &flatten_result,
+		BenchResult &simplify_result, BenchResult &codegen_result, BenchResult &pass_result){
+	Parser *parser=new Parser(filename);
+	if(!parser->doParse()){
+		SAFE_DELETE(parser);
+		return false;
+	}
+	TranslationUnitAST &tunit=parser->getAST();
+
+	for(int i=0; i<BENCH_WARMUP+samples; i++){
+		FlatAST ast;
+		double start=getTime();
+		ast.build(tunit);
+		double flatten_elapsed=getTime()-start;
+
+		Simplifier simplifier;
+		start=getTime();
+		simplifier.doSimplify(ast);
+		double simplify_elapsed=getTime()-start;
+
+		CodeGen *codegen=new CodeGen();
+		start=getTime();
+		bool generated=codegen->doCodeGen(ast, filename, "", false);
+		double codegen_elapsed=getTime()-start;
+		if(!generated){
+			SAFE_DELETE(codegen);
+			SAFE_DELETE(parser);
+			return false;
+		}
+
+		llvm::PassManager pm;
+		pm.add(llvm::createPromoteMemoryToRegisterPass());
+		start=getTime();
+		pm.run(codegen->getModule());
+		double pass_elapsed=getTime()-start;
+		SAFE_DELETE(codegen);
+
+		if(i>=BENCH_WARMUP){
+			flatten_result.addSample(flatten_elapsed);
+			simplify_result.addSample(simplify_elapsed);
+			codegen_result.addSample(codegen_elapsed);
+			pass_result.addSample(pass_elapsed);
+		}
+	}
+	SAFE_DELETE(parser);
+	return true;
+}
+
+
+/**
+ * main関数
+ * 入力ファイルごとに字句解析，構文解析，FlatASTへの変換，式の簡約，コード生成，mem2regを個別に計測する
+ * usage : bench [-n samples] file...
+ */
+int main(int argc, char **argv){
+	int samples=BENCH_SAMPLES;
+	std::vector<std::string> inputs;
+	for(int i=1; i<argc; i++){
+		if(strcmp(argv[i], "-n")==0 && i+1<argc){
+			samples=std::max(atoi(argv[++i]), 1);
+		}else if(argv[i][0]=='-'){
+			fprintf(stderr,"%s は不明なオプションです\n", argv[i]);
+			return 1;
+		}else{
+			inputs.push_back(argv[i]);
+		}
+	}
+	if(inputs.empty()){
+		fprintf(stderr,"入力ファイル名が指定されていません\n");
+		return 1;
+	}
+
+	fprintf(stdout, "input\tstage\tsamples\tmedian_us\tp95_us\trewinds\trewound_tokens\n");
+	for(int i=0; i<inputs.size(); i++){
+		BenchResult lex, parse, flatten, simplify, codegen, mem2reg;
+		if(!benchLexer(inputs[i], samples, lex) ||
+				!benchParser(inputs[i], samples, parse) ||
+				!benchCodeGen(inputs[i], samples, flatten, simplify, codegen, mem2reg)){
+			fprintf(stderr, "err at %s\n", inputs[i].c_str());
+			return 1;
+		}
+		lex.print(inputs[i], "lex");
+		parse.print(inputs[i], "parse");
+		flatten.print(inputs[i], "flatten");
+		simplify.print(inputs[i], "simplify");
+		codegen.print(inputs[i], "codegen");
+		mem2reg.print(inputs[i], "mem2reg");
+	}
+	return 0;
+}
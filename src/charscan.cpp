@@ -0,0 +1,355 @@
+#include "charscan.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CHARSCAN_X86
+#include<emmintrin.h>
+#include<immintrin.h>
+#endif
+
+
+
+/************************************************
+スカラ実装
+************************************************/
+
+static int skipSpaceScalar(const char *buf, int index, int length, int *line){
+	while(index<length && isSpaceChar(buf[index])){
+		if(buf[index]=='\n')
+			(*line)++;
+		index++;
+	}
+	return index;
+}
+
+static int skipAlnumScalar(const char *buf, int index, int length){
+	while(index<length && isAlnumChar(buf[index]))
+		index++;
+	return index;
+}
+
+static int skipDigitScalar(const char *buf, int index, int length){
+	while(index<length && isDigitChar(buf[index]))
+		index++;
+	return index;
+}
+
+static int skipLineScalar(const char *buf, int index, int length){
+	while(index<length && buf[index]!='\n')
+		index++;
+	return index;
+}
+
+static int skipBlockCommentScalar(const char *buf, int index, int length, int *line){
+	while(index<length){
+		if(buf[index]=='\n'){
+			(*line)++;
+		}else if(buf[index]=='*' && index+1<length && buf[index+1]=='/'){
+			return index+2;
+		}
+		index++;
+	}
+	return index;
+}
+
+
+
+#ifdef CHARSCAN_X86
+/************************************************
+SSE2実装(16バイト単位)
+************************************************/
+
+/**
+  * 各バイトが[lo, lo+range]に入るかのマスク
+  */
+static inline __m128i inRange16(__m128i v, char lo, char range){
+	__m128i d=_mm_sub_epi8(v, _mm_set1_epi8(lo));
+	return _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(range)), d);
+}
+
+static inline unsigned spaceMask16(__m128i v){
+	__m128i m=_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+			inRange16(v, '\t', '\r'-'\t'));
+	return _mm_movemask_epi8(m);
+}
+
+static inline unsigned digitMask16(__m128i v){
+	return _mm_movemask_epi8(inRange16(v, '0', 9));
+}
+
+static inline unsigned alnumMask16(__m128i v){
+	__m128i alpha=inRange16(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z'-'a');
+	return _mm_movemask_epi8(_mm_or_si128(alpha, inRange16(v, '0', 9)));
+}
+
+static inline unsigned charMask16(__m128i v, char c){
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+}
+
+static int skipSpaceSSE2(const char *buf, int index, int length, int *line){
+	while(index+16<=length){
+		__m128i v=_mm_loadu_si128((const __m128i*)(buf+index));
+		unsigned stop=~spaceMask16(v) & 0xffff;
+		unsigned nl=charMask16(v, '\n');
+		if(stop){
+			int pos=__builtin_ctz(stop);
+			*line+=__builtin_popcount(nl & ((1u<<pos)-1));
+			return index+pos;
+		}
+		*line+=__builtin_popcount(nl);
+		index+=16;
+	}
+	return skipSpaceScalar(buf, index, length, line);
+}
+
+static int skipAlnumSSE2(const char *buf, int index, int length){
+	while(index+16<=length){
+		__m128i v=_mm_loadu_si128((const __m128i*)(buf+index));
+		unsigned stop=~alnumMask16(v) & 0xffff;
+		if(stop)
+			return index+__builtin_ctz(stop);
+		index+=16;
+	}
+	return skipAlnumScalar(buf, index, length);
+}
+
+static int skipDigitSSE2(const char *buf, int index, int length){
+	while(index+16<=length){
+		__m128i v=_mm_loadu_si128((const __m128i*)(buf+index));
+		unsigned stop=~digitMask16(v) & 0xffff;
+		if(stop)
+			return index+__builtin_ctz(stop);
+		index+=16;
+	}
+	return skipDigitScalar(buf, index, length);
+}
+
+static int skipLineSSE2(const char *buf, int index, int length){
+	while(index+16<=length){
+		__m128i v=_mm_loadu_si128((const __m128i*)(buf+index));
+		unsigned nl=charMask16(v, '\n');
+		if(nl)
+			return index+__builtin_ctz(nl);
+		index+=16;
+	}
+	return skipLineScalar(buf, index, length);
+}
+
+static int skipBlockCommentSSE2(const char *buf, int index, int length, int *line){
+	while(index+16<=length){
+		__m128i v=_mm_loadu_si128((const __m128i*)(buf+index));
+		unsigned star=charMask16(v, '*');
+		unsigned nl=charMask16(v, '\n');
+		if(!star){
+			*line+=__builtin_popcount(nl);
+			index+=16;
+			continue;
+		}
+		//'*'の直前まで進めて"*/"か確認
+		int pos=__builtin_ctz(star);
+		*line+=__builtin_popcount(nl & ((1u<<pos)-1));
+		index+=pos;
+		if(index+1<length && buf[index+1]=='/')
+			return index+2;
+		index++;
+	}
+	return skipBlockCommentScalar(buf, index, length, line);
+}
+
+
+
+/************************************************
+AVX2実装(32バイト単位)
+************************************************/
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+AVX2_TARGET static inline __m256i inRange32(__m256i v, char lo, char range){
+	__m256i d=_mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+	return _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(range)), d);
+}
+
+AVX2_TARGET static inline unsigned spaceMask32(__m256i v){
+	__m256i m=_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+			inRange32(v, '\t', '\r'-'\t'));
+	return _mm256_movemask_epi8(m);
+}
+
+AVX2_TARGET static inline unsigned digitMask32(__m256i v){
+	return _mm256_movemask_epi8(inRange32(v, '0', 9));
+}
+
+AVX2_TARGET static inline unsigned alnumMask32(__m256i v){
+	__m256i alpha=inRange32(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z'-'a');
+	return _mm256_movemask_epi8(_mm256_or_si256(alpha, inRange32(v, '0', 9)));
+}
+
+AVX2_TARGET static inline unsigned charMask32(__m256i v, char c){
+	return _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)));
+}
+
+AVX2_TARGET static int skipSpaceAVX2(const char *buf, int index, int length, int *line){
+	while(index+32<=length){
+		__m256i v=_mm256_loadu_si256((const __m256i*)(buf+index));
+		unsigned stop=~spaceMask32(v);
+		unsigned nl=charMask32(v, '\n');
+		if(stop){
+			int pos=__builtin_ctz(stop);
+			*line+=__builtin_popcount(nl & ((1u<<pos)-1));
+			return index+pos;
+		}
+		*line+=__builtin_popcount(nl);
+		index+=32;
+	}
+	return skipSpaceSSE2(buf, index, length, line);
+}
+
+AVX2_TARGET static int skipAlnumAVX2(const char *buf, int index, int length){
+	while(index+32<=length){
+		__m256i v=_mm256_loadu_si256((const __m256i*)(buf+index));
+		unsigned stop=~alnumMask32(v);
+		if(stop)
+			return index+__builtin_ctz(stop);
+		index+=32;
+	}
+	return skipAlnumSSE2(buf, index, length);
+}
+
+AVX2_TARGET static int skipDigitAVX2(const char *buf, int index, int length){
+	while(index+32<=length){
+		__m256i v=_mm256_loadu_si256((const __m256i*)(buf+index));
+		unsigned stop=~digitMask32(v);
+		if(stop)
+			return index+__builtin_ctz(stop);
+		index+=32;
+	}
+	return skipDigitSSE2(buf, index, length);
+}
+
+AVX2_TARGET static int skipLineAVX2(const char *buf, int index, int length){
+	while(index+32<=length){
+		__m256i v=_mm256_loadu_si256((const __m256i*)(buf+index));
+		unsigned nl=charMask32(v, '\n');
+		if(nl)
+			return index+__builtin_ctz(nl);
+		index+=32;
+	}
+	return skipLineSSE2(buf, index, length);
+}
+
+AVX2_TARGET static int skipBlockCommentAVX2(const char *buf, int index, int length, int *line){
+	while(index+32<=length){
+		__m256i v=_mm256_loadu_si256((const __m256i*)(buf+index));
+		unsigned star=charMask32(v, '*');
+		unsigned nl=charMask32(v, '\n');
+		if(!star){
+			*line+=__builtin_popcount(nl);
+			index+=32;
+			continue;
+		}
+		int pos=__builtin_ctz(star);
+		*line+=__builtin_popcount(nl & ((1u<<pos)-1));
+		index+=pos;
+		if(index+1<length && buf[index+1]=='/')
+			return index+2;
+		index++;
+	}
+	return skipBlockCommentSSE2(buf, index, length, line);
+}
+#endif
+
+
+
+/************************************************
+実装の選択
+************************************************/
+
+static const CharScanner ScalarScanner={
+	skipSpaceScalar, skipAlnumScalar, skipDigitScalar,
+	skipLineScalar, skipBlockCommentScalar
+};
+
+#ifdef CHARSCAN_X86
+static const CharScanner SSE2Scanner={
+	skipSpaceSSE2, skipAlnumSSE2, skipDigitSSE2,
+	skipLineSSE2, skipBlockCommentSSE2
+};
+
+static const CharScanner AVX2Scanner={
+	skipSpaceAVX2, skipAlnumAVX2, skipDigitAVX2,
+	skipLineAVX2, skipBlockCommentAVX2
+};
+#endif
+
+static ScanMode CurScanMode=SCAN_AUTO;
+static const CharScanner *CurScanner=NULL;
+
+
+/**
+  * 走査実装の設定
+  * SCAN_AUTOの場合は実行中のCPUで使える最速の実装を選ぶ
+  * @param ScanMode
+  * @return 成功時：true　CPUが未対応の場合：false
+  */
+bool setScanMode(ScanMode mode){
+#ifdef CHARSCAN_X86
+	__builtin_cpu_init();
+	bool has_avx2=__builtin_cpu_supports("avx2");
+	if(mode==SCAN_AUTO)
+		mode = has_avx2 ? SCAN_AVX2 : SCAN_SSE2;
+
+	if(mode==SCAN_AVX2 && has_avx2){
+		CurScanner=&AVX2Scanner;
+	}else if(mode==SCAN_SSE2){
+		CurScanner=&SSE2Scanner;
+	}else if(mode==SCAN_SCALAR){
+		CurScanner=&ScalarScanner;
+	}else{
+		return false;
+	}
+#else
+	if(mode==SCAN_AUTO)
+		mode=SCAN_SCALAR;
+	if(mode!=SCAN_SCALAR)
+		return false;
+	CurScanner=&ScalarScanner;
+#endif
+	CurScanMode=mode;
+	return true;
+}
+
+
+/**
+  * 現在の走査実装種別を取得
+  */
+ScanMode getScanMode(){
+	if(!CurScanner)
+		setScanMode(SCAN_AUTO);
+	return CurScanMode;
+}
+
+
+/**
+  * 走査実装種別の名前を取得
+  */
+const char *getScanModeName(ScanMode mode){
+	switch(mode){
+		case SCAN_SCALAR:
+			return "scalar";
+		case SCAN_SSE2:
+			return "sse2";
+		case SCAN_AVX2:
+			return "avx2";
+		default:
+			return "auto";
+	}
+}
+
+
+/**
+  * 現在の走査関数群を取得
+  * 未設定の場合はSCAN_AUTOで初期化する
+  */
+const CharScanner &getCharScanner(){
+	if(!CurScanner)
+		setScanMode(SCAN_AUTO);
+	return *CurScanner;
+}
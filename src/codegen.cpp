@@ -6,6 +6,10 @@
 CodeGen::CodeGen(){
 	Builder = new llvm::IRBuilder<>(llvm::getGlobalContext());
 	Mod = NULL;
+	GuaranteedTailCalls = false;
+	Memoize = false;
+	NumPureFunctions = 0;
+	MemoReport = NULL;
 }
 
 /**
@@ -19,13 +23,34 @@ CodeGen::~CodeGen(){
 
 /**
   * コード生成実行
+  * TranslationUnitASTはFlatASTに変換してからコード生成する
   * @param  TranslationUnitAST　Module名(入力ファイル名)
   * @return 成功時：true　失敗時:false
   */
 bool CodeGen::doCodeGen(TranslationUnitAST &tunit, std::string name, 
 		std::string link_file, bool with_jit=false){
+	FlatAST ast;
+	if(!ast.build(tunit))
+		return false;
+	return doCodeGen(ast, name, link_file, with_jit);
+}
+
+
+/**
+  * コード生成実行
+  * @param  FlatAST　Module名(入力ファイル名)
+  * @return 成功時：true　失敗時:false
+  */
+bool CodeGen::doCodeGen(FlatAST &ast, std::string name, 
+		std::string link_file, bool with_jit=false){
+	//ノードの参照が壊れている
+	if(ast.hasIndexOverflow())
+		return false;
 
-	if(!generateTranslationUnit(tunit, name)){
+	AST=&ast;
+	bool result=generateTranslationUnit(name);
+	AST=NULL;
+	if(!result){
 		return false;
 	}
 
@@ -35,8 +60,10 @@ bool CodeGen::doCodeGen(TranslationUnitAST &tunit, std::string name,
 
 	//JITのフラグが立っていたらJIT
 	if(with_jit){
-		llvm::ExecutionEngine *EE = llvm::EngineBuilder(Mod).create();
-		llvm::EngineBuilder(Mod).create();
+		//fastccの末尾呼び出しはGuaranteedTailCallOptの時のみ除去が保証される
+		llvm::TargetOptions options;
+		options.GuaranteedTailCallOpt = GuaranteedTailCalls;
+		llvm::ExecutionEngine *EE = llvm::EngineBuilder(Mod).setTargetOptions(options).create();
 			llvm::Function *F;
 		if(!(F=Mod->getFunction("main")))
 			return false;
@@ -62,53 +89,60 @@ llvm::Module &CodeGen::getModule(){
 
 /**
   * Module生成メソッド
-  * @param  TranslationUnitAST Module名(入力ファイル名)
+  * @param  Module名(入力ファイル名)
   * @return 成功時：true　失敗時：false　
   */
-bool CodeGen::generateTranslationUnit(TranslationUnitAST &tunit, std::string name){
+bool CodeGen::generateTranslationUnit(std::string name){
 	Mod = new llvm::Module(name, llvm::getGlobalContext());
+	DefinedFunctions.clear();
+	for(int i=0; i<AST->getFunctionNum(); i++)
+		DefinedFunctions.insert(AST->getPrototype(AST->getFunction(i).Proto).Name);
+	findMemoFunctions();
+
 	//funtion declaration
-	for(int i=0; ; i++){
-		PrototypeAST *proto=tunit.getPrototype(i);
-		if(!proto)
-			break;
-		else if(!generatePrototype(proto, Mod)){
+	for(int i=0; i<AST->getDeclarationNum(); i++){
+		if(!generatePrototype(AST->getDeclaration(i), Mod)){
 			SAFE_DELETE(Mod);
 			return false;
 		}
 	}
 
 	//function definition
-	for(int i=0; ; i++){
-		FunctionAST *func=tunit.getFunction(i);
-		if(!func)
-			break;
-		else if(!(generateFunctionDefinition(func, Mod))){
+	for(int i=0; i<AST->getFunctionNum(); i++){
+		if(!(generateFunctionDefinition(AST->getFunction(i), Mod))){
 			SAFE_DELETE(Mod);
 			return false;
 		}
 	}
 
+	if(MemoReport)
+		generateMemoReport();
+
 	return true;
 }
 
 
 /**
   * 関数定義生成メソッド
-  * @param  FunctionAST Module
+  * @param  FlatFunction Module
   * @return 生成したFunctionのポインタ
   */
-llvm::Function *CodeGen::generateFunctionDefinition(FunctionAST *func_ast,
+llvm::Function *CodeGen::generateFunctionDefinition(const FlatFunction &func_ast,
 		llvm::Module *mod){
-	llvm::Function *func=generatePrototype(func_ast->getPrototype(), mod);
+	llvm::Function *func=generatePrototype(AST->getPrototype(func_ast.Proto), mod);
 	if(!func){
 		return NULL;
 	}
 	CurFunc = func;
+	CurFuncName = AST->getPrototype(func_ast.Proto).Name;
+	//メモ化する関数の本体は別の関数に生成する
+	if(MemoFunctions.count(CurFuncName))
+		CurFunc = generateMemoWrapper(func);
+	SharedValues.clear();
 	llvm::BasicBlock *bblock=llvm::BasicBlock::Create(llvm::getGlobalContext(),
-									"entry",func);
+									"entry",CurFunc);
 	Builder->SetInsertPoint(bblock);
-	generateFunctionStatement(func_ast->getBody());
+	generateFunctionStatement(func_ast);
 
 	return func;
 }
@@ -116,24 +150,26 @@ llvm::Function *CodeGen::generateFunctionDefinition(FunctionAST *func_ast,
 
 /**
   * 関数宣言生成メソッド
-  * @param  PrototypeAST, Module
+  * @param  FlatPrototype, Module
   * @return 生成したFunctionのポインタ
   */
-llvm::Function *CodeGen::generatePrototype(PrototypeAST *proto, llvm::Module *mod){
+llvm::Function *CodeGen::generatePrototype(const FlatPrototype &proto, llvm::Module *mod){
+	const std::string &name=getSymbolName(proto.Name);
+
 	//already declared?
-	llvm::Function *func=mod->getFunction(proto->getName());
+	llvm::Function *func=mod->getFunction(name);
 	if(func){
-		if(func->arg_size()==proto->getParamNum() && 
+		if(func->arg_size()==proto.NumParams && 
 				func->empty()){
 			return func;
 		}else{
-			fprintf(stderr, "error::function %s is redefined",proto->getName().c_str());
+			fprintf(stderr, "error::function %s is redefined",name.c_str());
 			return NULL;
 		}
 	}
 
 	//create arg_types
-	std::vector<llvm::Type*> int_types(proto->getParamNum(),
+	llvm::SmallVector<llvm::Type*, 8> int_types(proto.NumParams,
 								llvm::Type::getInt32Ty(llvm::getGlobalContext()));
 
 	//create func type
@@ -144,13 +180,17 @@ llvm::Function *CodeGen::generatePrototype(PrototypeAST *proto, llvm::Module *mo
 	//create function
 	func=llvm::Function::Create(func_type, 
 							llvm::Function::ExternalLinkage,
-							proto->getName(),
+							name,
 							mod);
 
+	//Module内で定義する関数(外部から呼ばれるmainを除く)はfastccで呼び合う
+	if(GuaranteedTailCalls && DefinedFunctions.count(proto.Name) && name!="main")
+		func->setCallingConv(llvm::CallingConv::Fast);
+
 	//set names
 	llvm::Function::arg_iterator arg_iter=func->arg_begin();
-	for(int i=0; i<proto->getParamNum(); i++){
-		arg_iter->setName(proto->getParamName(i).append("_arg"));
+	for(int i=0; i<proto.NumParams; i++){
+		arg_iter->setName(llvm::Twine(getSymbolName(AST->getParam(proto.ParamBegin+i)))+"_arg");
 		++arg_iter;
 	}
 
@@ -161,31 +201,56 @@ llvm::Function *CodeGen::generatePrototype(PrototypeAST *proto, llvm::Module *mo
 /**
   * 関数生成メソッド
   * 変数宣言、ステートメントの順に生成　
-  * @param  FunctionStmtAST
+  * 最初のreturnが自己末尾呼び出しの場合は，変数宣言の後に分岐先のブロックを置く
+  * @param  FlatFunction
   * @return 最後に生成したValueのポインタ
   */
-llvm::Value *CodeGen::generateFunctionStatement(FunctionStmtAST *func_stmt){
+llvm::Value *CodeGen::generateFunctionStatement(const FlatFunction &func){
 	//insert variable decls
-	VariableDeclAST *vdecl;
 	llvm::Value *v=NULL;
-	for(int i=0; ; i++){
-		//最後まで見たら終了
-		if(!func_stmt->getVariableDecl(i))
-			break;
-
+	ParamAllocas.clear();
+	for(int i=0; i<func.NumDecls; i++){
 		//create alloca
-		vdecl=llvm::dyn_cast<VariableDeclAST>(func_stmt->getVariableDecl(i));
-		v=generateVariableDeclaration(vdecl);
+		v=generateVariableDeclaration(AST->getVariableDecl(func.DeclBegin+i));
+	}
+
+	//find self tail call (最初のreturnより後の文は実行されない)
+	TailBlock=NULL;
+	TailAcc=NULL;
+	for(int i=0; i<func.NumStmts; i++){
+		FlatRef stmt=AST->getStatement(func.StmtBegin+i);
+		if(FLAT_ID(stmt)!=JumpStmtID)
+			continue;
+		FlatRef call, operand;
+		if(matchSelfTailCall(AST->getJumpExpr(stmt), call, operand, TailAccOp)){
+			//DummyCには条件分岐が無いため，自身を末尾で呼び出す関数は戻らない
+			//(スタックの溢れではなく無限ループになる)
+			fprintf(stderr, "warning::function %s never returns (unconditional self tail call)\n",
+					getSymbolName(CurFuncName).c_str());
+			if(TailAccOp!=AssignOp){
+				//累積値の初期値は演算の単位元
+				TailAcc=Builder->CreateAlloca(
+						llvm::Type::getInt32Ty(llvm::getGlobalContext()), 0, "tail_acc");
+				Builder->CreateStore(llvm::ConstantInt::get(
+						llvm::Type::getInt32Ty(llvm::getGlobalContext()),
+						TailAccOp==MulOp ? 1 : 0), TailAcc);
+			}
+			TailBlock=llvm::BasicBlock::Create(llvm::getGlobalContext(),
+											"tail_recurse", CurFunc);
+			Builder->CreateBr(TailBlock);
+			Builder->SetInsertPoint(TailBlock);
+		}
+		break;
 	}
 
 	//insert expr statement
-	BaseAST *stmt;
-	for(int i=0; ; i++){
-		stmt=func_stmt->getStatement(i);
-		if(!stmt)
+	for(int i=0; i<func.NumStmts; i++){
+		FlatRef stmt=AST->getStatement(func.StmtBegin+i);
+		if(FLAT_ID(stmt)!=NullExprID)
+			v=visitExpression(stmt);
+		//return以降は到達しない(終端命令の後に命令を置かない)
+		if(FLAT_ID(stmt)==JumpStmtID)
 			break;
-		else if(!llvm::isa<NullExprAST>(stmt))
-			v=generateStatement(stmt);
 	}
 
 	return v;
@@ -194,205 +259,436 @@ llvm::Value *CodeGen::generateFunctionStatement(FunctionStmtAST *func_stmt){
 
 /**
   * 変数宣言(alloca命令)生成メソッド
-  * @param VariableDeclAST
+  * @param FlatVariableDecl
   * @return 生成したValueのポインタ
   */
-llvm::Value *CodeGen::generateVariableDeclaration(VariableDeclAST *vdecl){
+llvm::Value *CodeGen::generateVariableDeclaration(const FlatVariableDecl &vdecl){
+	const std::string &name=getSymbolName(vdecl.Name);
+
 	//create alloca
 	llvm::AllocaInst *alloca=Builder->CreateAlloca(
 			llvm::Type::getInt32Ty(llvm::getGlobalContext()),
 			0,
-			vdecl->getName());
+			name);
 
 	//if args alloca
-	if(vdecl->getType()==VariableDeclAST::param){
+	if(vdecl.Type==VariableDeclAST::param){
 		//store args
 		llvm::ValueSymbolTable &vs_table = CurFunc->getValueSymbolTable();
-		Builder->CreateStore(vs_table.lookup(vdecl->getName().append("_arg")), alloca);
+		llvm::SmallString<32> arg_name;
+		(llvm::Twine(name)+"_arg").toVector(arg_name);
+		Builder->CreateStore(vs_table.lookup(arg_name), alloca);
+		ParamAllocas.push_back(alloca);
 	}
-	//ValueMap[vdecl->getName()]=alloca;
 	return alloca;
 }
 
 
-/**
-  * ステートメント生成メソッド
-  * 実際にはASTの種類を確認して各種生成メソッドを呼び出し
-  * @param  JumpStmtAST
-  * @return 生成したValueのポインタ
-  */
-llvm::Value *CodeGen::generateStatement(BaseAST *stmt){
-	if(llvm::isa<BinaryExprAST>(stmt)){
-		return generateBinaryExpression(llvm::dyn_cast<BinaryExprAST>(stmt));
-	}else if(llvm::isa<CallExprAST>(stmt)){
-		return generateCallExpression(llvm::dyn_cast<CallExprAST>(stmt));
-	}else if(llvm::isa<JumpStmtAST>(stmt)){
-		return generateJumpStatement(llvm::dyn_cast<JumpStmtAST>(stmt));
-	}else{
-		return NULL;
-	}
-}
-
-
 /**
   * 二項演算生成メソッド
-  * @param  JumpStmtAST
+  * 代入式の値は代入した値とする．
+  * FlatASTがノードを共有している場合，代入以外は関数内で1度だけ生成する
+  * @param  二項演算の参照，FlatBinary
   * @return 生成したValueのポインタ
   */
-llvm::Value *CodeGen::generateBinaryExpression(BinaryExprAST *bin_expr){
-	BaseAST *lhs=bin_expr->getLHS();
-	BaseAST *rhs=bin_expr->getRHS();
-
+llvm::Value *CodeGen::visitBinaryExpression(FlatRef ref, const FlatBinary &bin_expr){
 	llvm::Value *lhs_v;
 	llvm::Value *rhs_v;
+	bool shared=(bin_expr.Op!=AssignOp && AST->isShared());
+	if(shared){
+		llvm::DenseMap<FlatRef, llvm::Value*>::iterator it=SharedValues.find(ref);
+		if(it!=SharedValues.end())
+			return it->second;
+	}
 
 	//assignment
-	if(bin_expr->getOp()=="="){
+	if(bin_expr.Op==AssignOp){
 		//lhs is variable
-		VariableAST *lhs_var=llvm::dyn_cast<VariableAST>(lhs);
 		llvm::ValueSymbolTable &vs_table = CurFunc->getValueSymbolTable();
-		lhs_v = vs_table.lookup(lhs_var->getName());
+		lhs_v = vs_table.lookup(getSymbolName(AST->getVariable(bin_expr.LHS)));
 
 	//other operand
 	}else{
-		//lhs=?
-		//Binary?
-		if(llvm::isa<BinaryExprAST>(lhs)){
-			lhs_v=generateBinaryExpression(llvm::dyn_cast<BinaryExprAST>(lhs));
-
-		//Variable?
-        }else if(llvm::isa<VariableAST>(lhs)){
-			lhs_v=generateVariable(llvm::dyn_cast<VariableAST>(lhs));
-
-		//Number?
-        }else if(llvm::isa<NumberAST>(lhs)){
-			NumberAST *num=llvm::dyn_cast<NumberAST>(lhs);
-			lhs_v=generateNumber(num->getNumberValue());
-		}
+		lhs_v=visitExpression(bin_expr.LHS);
 	}
 
-
 	//create rhs value
-	if(llvm::isa<BinaryExprAST>(rhs)){
-		rhs_v=generateBinaryExpression(llvm::dyn_cast<BinaryExprAST>(rhs));
+	rhs_v=visitExpression(bin_expr.RHS);
 
-	//CallExpr?
-    }else if(llvm::isa<CallExprAST>(rhs)){
-		rhs_v=generateCallExpression(llvm::dyn_cast<CallExprAST>(rhs));
+	llvm::Value *v=NULL;
+	switch(bin_expr.Op){
+		case AssignOp:
+			//store
+			Builder->CreateStore(rhs_v, lhs_v);
+			return rhs_v;
+		case AddOp:
+			//add
+			v=Builder->CreateAdd(lhs_v, rhs_v, "add_tmp");
+			break;
+		case SubOp:
+			//sub
+			v=Builder->CreateSub(lhs_v, rhs_v, "sub_tmp");
+			break;
+		case MulOp:
+			//mul
+			v=Builder->CreateMul(lhs_v, rhs_v, "mul_tmp");
+			break;
+		case DivOp:
+			//div
+			v=Builder->CreateSDiv(lhs_v, rhs_v, "div_tmp");
+			break;
+	}
+	if(shared)
+		SharedValues[ref]=v;
+	return v;
+}
 
-	//Variable?
-    }else if(llvm::isa<VariableAST>(rhs)){
-		rhs_v=generateVariable(llvm::dyn_cast<VariableAST>(rhs));
 
-	//Number?
-    }else if(llvm::isa<NumberAST>(rhs)){
-		NumberAST *num=llvm::dyn_cast<NumberAST>(rhs);
-		rhs_v=generateNumber(num->getNumberValue());
+/**
+  * 関数呼び出し(Call命令)生成メソッド
+  * @param 関数呼び出しの参照，FlatCall
+  * @return 生成したValueのポインタ　
+  */
+llvm::Value *CodeGen::visitCallExpression(FlatRef, const FlatCall &call_expr){
+	llvm::SmallVector<llvm::Value*, 8> arg_vec;
+	for(int i=0; i<call_expr.NumArgs; i++)
+		arg_vec.push_back(visitExpression(AST->getArg(call_expr.ArgBegin+i)));
+	llvm::Function *callee=Mod->getFunction(getSymbolName(call_expr.Callee));
+	llvm::CallInst *call=Builder->CreateCall(callee, arg_vec, "call_tmp");
+	call->setCallingConv(callee->getCallingConv());
+	return call;
+}
+
+
+/**
+  * ジャンプ(今回はreturn命令のみ)生成メソッド
+  * @param  ジャンプ文の参照，returnする式の参照
+  * @return 生成したValueのポインタ
+  */
+llvm::Value *CodeGen::visitJumpStatement(FlatRef, FlatRef expr){
+	FlatRef call, operand;
+	BinaryOp op;
+	if(TailBlock && matchSelfTailCall(expr, call, operand, op))
+		return generateSelfTailCall(expr, call, operand, op);
+
+	llvm::Value *ret_v=visitExpression(expr);
+	//基底部のreturn(累積値を掛ける・足す)．
+	//条件分岐が無い現状では最初のreturnが自己末尾呼び出しになり，ここには到達しない
+	if(TailAcc){
+		llvm::Value *acc_v=Builder->CreateLoad(TailAcc, "acc_tmp");
+		ret_v=generateAccumulate(TailAccOp, acc_v, ret_v);
 	}
 
-	
-	
-	if(bin_expr->getOp()=="="){
-		//store
-		return Builder->CreateStore(rhs_v, lhs_v);
-	}else if(bin_expr->getOp()=="+"){
-		//add
-		return Builder->CreateAdd(lhs_v, rhs_v, "add_tmp");
-	}else if(bin_expr->getOp()=="-"){
-		//sub
-		return Builder->CreateSub(lhs_v, rhs_v, "sub_tmp");
-	}else if(bin_expr->getOp()=="*"){
-		//mul
-		return Builder->CreateMul(lhs_v, rhs_v, "mul_tmp");
-	}else if(bin_expr->getOp()=="/"){
-		//div
-		return Builder->CreateSDiv(lhs_v, rhs_v, "div_tmp");
+	//mainの終了時にメモ化のヒット率を表示
+	if(MemoReport && CurFunc->getName()=="main"){
+		Builder->CreateCall(MemoReport);
+	}else if(!TailAcc){
+		//他の関数の末尾呼び出し
+		if(llvm::CallInst *call_inst=llvm::dyn_cast<llvm::CallInst>(ret_v))
+			call_inst->setTailCall();
 	}
+	return Builder->CreateRet(ret_v);
 }
 
 
 /**
-  * 関数呼び出し(Call命令)生成メソッド
-  * @param CallExprAST
-  * @return 生成したValueのポインタ　
+  * 自己末尾呼び出しの判定
+  * f(...)，x+f(...)，x*f(...)(f(...)が左辺の場合はxが安全な式に限る)の形を受け付ける
+  * @param returnする式，自己呼び出し・累積する被演算子・演算の格納先
+  *        (累積しない場合，被演算子はNullExpr，演算はAssignOp)
+  * @return 自己末尾呼び出し：true　それ以外：false
   */
-llvm::Value *CodeGen::generateCallExpression(CallExprAST *call_expr){
-	std::vector<llvm::Value*> arg_vec;
-	BaseAST *arg;
-	llvm::Value *arg_v;
-	llvm::ValueSymbolTable &vs_table = CurFunc->getValueSymbolTable();
-	for(int i=0; ; i++){
-		if(!(arg=call_expr->getArgs(i)))
-			break;
+bool CodeGen::matchSelfTailCall(FlatRef expr, FlatRef &call, FlatRef &operand, BinaryOp &op){
+	if(isSelfCall(expr)){
+		call=expr;
+		operand=FLAT_REF(NullExprID, 0);
+		op=AssignOp;
+		return true;
+	}
+	if(FLAT_ID(expr)!=BinaryExprID)
+		return false;
 
-		//isCall
-		if(llvm::isa<CallExprAST>(arg))
-			arg_v=generateCallExpression(llvm::dyn_cast<CallExprAST>(arg));
+	//i32の加算・乗算は結合的かつ可換なため累積の順序を入れ替えられる
+	const FlatBinary &bin_expr=AST->getBinary(expr);
+	if(bin_expr.Op!=AddOp && bin_expr.Op!=MulOp)
+		return false;
+	if(isSelfCall(bin_expr.RHS)){
+		call=bin_expr.RHS;
+		operand=bin_expr.LHS;
+	}else if(isSelfCall(bin_expr.LHS) && isSafeOperand(bin_expr.RHS)){
+		call=bin_expr.LHS;
+		operand=bin_expr.RHS;
+	}else{
+		return false;
+	}
+	op=bin_expr.Op;
+	return true;
+}
 
-		//isBinaryExpr
-		else if(llvm::isa<BinaryExprAST>(arg)){
-			BinaryExprAST *bin_expr = llvm::dyn_cast<BinaryExprAST>(arg);
 
-			//二項演算命令を生成
-			arg_v=generateBinaryExpression(llvm::dyn_cast<BinaryExprAST>(arg));
+/**
+  * 生成中の関数自身の呼び出しか
+  */
+bool CodeGen::isSelfCall(FlatRef expr){
+	if(FLAT_ID(expr)!=CallExprID)
+		return false;
+	const FlatCall &call_expr=AST->getCall(expr);
+	return call_expr.Callee==CurFuncName && call_expr.NumArgs==ParamAllocas.size();
+}
 
-			//代入の時はLoad命令を追加
-			if(bin_expr->getOp()=="="){
-				VariableAST *var= llvm::dyn_cast<VariableAST>(bin_expr->getLHS());
-				arg_v=Builder->CreateLoad(vs_table.lookup(var->getName()), "arg_val");
-			}
-		}
 
-		//isVar
-		else if(llvm::isa<VariableAST>(arg))
-			arg_v=generateVariable(llvm::dyn_cast<VariableAST>(arg));
-		
-		//isNumber
-		else if(llvm::isa<NumberAST>(arg)){
-			NumberAST *num=llvm::dyn_cast<NumberAST>(arg);
-			arg_v=generateNumber(num->getNumberValue());
+/**
+  * 自己呼び出しより前に評価してよい式か
+  * 関数呼び出し(出力の順序が変わる)と除算(0除算の時期が変わる)を含まないこと
+  */
+bool CodeGen::isSafeOperand(FlatRef expr){
+	switch(FLAT_ID(expr)){
+		case BinaryExprID:{
+			const FlatBinary &bin_expr=AST->getBinary(expr);
+			if(bin_expr.Op==DivOp)
+				return false;
+			return (bin_expr.Op==AssignOp || isSafeOperand(bin_expr.LHS)) &&
+				isSafeOperand(bin_expr.RHS);
 		}
-		arg_vec.push_back(arg_v);
+		case VariableID:
+		case NumberID:
+			return true;
+		default:
+			return false;
 	}
-	return Builder->CreateCall( Mod->getFunction(call_expr->getCallee()),
-										arg_vec,"call_tmp" );
 }
 
 
 /**
-  * ジャンプ(今回はreturn命令のみ)生成メソッド
-  * @param  JumpStmtAST
+  * 自己末尾呼び出し(関数本体の先頭への分岐)生成メソッド
+  * 元の式と同じ順に被演算子と実引数を評価し，累積値を更新してから引数の変数に格納する
+  * @param returnする式，自己呼び出しの参照，累積する被演算子の参照，累積する演算
+  * @return 生成した分岐命令
+  */
+llvm::Value *CodeGen::generateSelfTailCall(FlatRef expr, FlatRef call, FlatRef operand, BinaryOp op){
+	FlatCall call_expr=AST->getCall(call);
+	bool operand_first=(op!=AssignOp && AST->getBinary(expr).LHS==operand);
+	llvm::Value *operand_v=NULL;
+	if(operand_first)
+		operand_v=visitExpression(operand);
+
+	llvm::SmallVector<llvm::Value*, 8> arg_vec;
+	for(int i=0; i<call_expr.NumArgs; i++)
+		arg_vec.push_back(visitExpression(AST->getArg(call_expr.ArgBegin+i)));
+
+	if(op!=AssignOp){
+		if(!operand_first)
+			operand_v=visitExpression(operand);
+		llvm::Value *acc_v=Builder->CreateLoad(TailAcc, "acc_tmp");
+		Builder->CreateStore(generateAccumulate(op, acc_v, operand_v), TailAcc);
+	}
+
+	for(int i=0; i<arg_vec.size(); i++)
+		Builder->CreateStore(arg_vec[i], ParamAllocas[i]);
+	return Builder->CreateBr(TailBlock);
+}
+
+
+/**
+  * 累積値の演算生成メソッド
+  * @param 演算(AddOp，MulOp)，累積値，被演算子
   * @return 生成したValueのポインタ
   */
-llvm::Value *CodeGen::generateJumpStatement(JumpStmtAST *jump_stmt){
-	BaseAST *expr=jump_stmt->getExpr();
-	llvm::Value *ret_v;
-	if(llvm::isa<BinaryExprAST>(expr)){
-		ret_v=generateBinaryExpression(llvm::dyn_cast<BinaryExprAST>(expr));
-	}else if(llvm::isa<VariableAST>(expr)){
-		VariableAST *var=llvm::dyn_cast<VariableAST>(expr);
-		ret_v = generateVariable(var);
-	}else if(llvm::isa<NumberAST>(expr)){
-		NumberAST *num=llvm::dyn_cast<NumberAST>(expr);
-		ret_v=generateNumber(num->getNumberValue());
+llvm::Value *CodeGen::generateAccumulate(BinaryOp op, llvm::Value *lhs, llvm::Value *rhs){
+	if(op==MulOp)
+		return Builder->CreateMul(lhs, rhs, "acc_mul");
+	return Builder->CreateAdd(lhs, rhs, "acc_add");
+}
+
+
+/**
+  * メモ化する関数の選択
+  * 純粋かつ関数呼び出しを含み，引数が1つ以上MEMO_MAX_PARAMS以下の関数(mainを除く)をメモ化する．
+  * 条件分岐の無いDummyCでは再帰する関数は戻らないため，キャッシュが効くのは
+  * 同じ引数の呼び出しが呼び出しの木の中で繰り返される関数(f(n)=g(n)+g(n+1)等)．
+  * 葉関数は本体よりキャッシュを引く方が遅いためメモ化しない
+  */
+void CodeGen::findMemoFunctions(){
+	MemoFunctions.clear();
+	MemoNames.clear();
+	MemoHits.clear();
+	MemoCalls.clear();
+	MemoReport=NULL;
+	NumPureFunctions=0;
+	if(!Memoize)
+		return;
+
+	PurityAnalysis purity;
+	purity.analyze(*AST);
+	NumPureFunctions=purity.getPureNum();
+	for(int i=0; i<AST->getFunctionNum(); i++){
+		const FlatPrototype &proto=AST->getPrototype(AST->getFunction(i).Proto);
+		if(purity.isPure(proto.Name) && purity.hasCalls(proto.Name) &&
+				proto.NumParams>0 && proto.NumParams<=MEMO_MAX_PARAMS &&
+				getSymbolName(proto.Name)!="main")
+			MemoFunctions.insert(proto.Name);
+	}
+
+	if(!MemoFunctions.empty())
+		MemoReport=llvm::Function::Create(
+				llvm::FunctionType::get(llvm::Type::getVoidTy(llvm::getGlobalContext()), false),
+				llvm::Function::InternalLinkage,
+				"dcc.memo_report",
+				Mod);
+}
+
+
+/**
+  * メモ化する関数の生成メソッド
+  * 関数を引数をキーとするキャッシュ(直接写像，[フラグ, 引数..., 値]の配列)を引く処理にし，
+  * ヒットしなければ本体の関数を呼び出して結果を格納する．
+  * 再帰呼び出しは元の関数を呼ぶため，途中の呼び出し結果もキャッシュされる
+  * @param 元の関数(宣言のみ)
+  * @return 本体を生成する関数
+  */
+llvm::Function *CodeGen::generateMemoWrapper(llvm::Function *func){
+	llvm::LLVMContext &context=llvm::getGlobalContext();
+	llvm::Type *int_type=llvm::Type::getInt32Ty(context);
+	llvm::Type *count_type=llvm::Type::getInt64Ty(context);
+	std::string name=func->getName().str();
+	int num_params=func->arg_size();
+
+	//本体の関数(引数名は元の関数と同じ)
+	llvm::Function *body=llvm::Function::Create(func->getFunctionType(),
+							llvm::Function::InternalLinkage,
+							name+".body",
+							Mod);
+	body->setCallingConv(func->getCallingConv());
+	llvm::SmallVector<llvm::Value*, MEMO_MAX_PARAMS> args;
+	llvm::Function::arg_iterator body_arg=body->arg_begin();
+	for(llvm::Function::arg_iterator arg_iter=func->arg_begin();
+			arg_iter!=func->arg_end(); ++arg_iter, ++body_arg){
+		body_arg->setName(arg_iter->getName());
+		args.push_back(arg_iter);
+	}
 
+	//キャッシュ，ヒット回数，呼び出し回数
+	llvm::ArrayType *entry_type=llvm::ArrayType::get(int_type, num_params+2);
+	llvm::ArrayType *table_type=llvm::ArrayType::get(entry_type, 1<<MEMO_CACHE_BITS);
+	llvm::GlobalVariable *table=new llvm::GlobalVariable(*Mod, table_type, false,
+			llvm::GlobalValue::InternalLinkage, llvm::ConstantAggregateZero::get(table_type),
+			name+".memo");
+	llvm::GlobalVariable *hits=new llvm::GlobalVariable(*Mod, count_type, false,
+			llvm::GlobalValue::InternalLinkage, llvm::ConstantInt::get(count_type, 0),
+			name+".memo_hits");
+	llvm::GlobalVariable *calls=new llvm::GlobalVariable(*Mod, count_type, false,
+			llvm::GlobalValue::InternalLinkage, llvm::ConstantInt::get(count_type, 0),
+			name+".memo_calls");
+	MemoNames.push_back(CurFuncName);
+	MemoHits.push_back(hits);
+	MemoCalls.push_back(calls);
+
+	llvm::BasicBlock *entry=llvm::BasicBlock::Create(context, "entry", func);
+	llvm::BasicBlock *hit_block=llvm::BasicBlock::Create(context, "memo_hit", func);
+	llvm::BasicBlock *miss_block=llvm::BasicBlock::Create(context, "memo_miss", func);
+	Builder->SetInsertPoint(entry);
+	Builder->CreateStore(Builder->CreateAdd(Builder->CreateLoad(calls),
+				llvm::ConstantInt::get(count_type, 1)), calls);
+
+	//引数のハッシュ値(i32単位のFNV-1a)でエントリを選ぶ
+	llvm::Value *hash=llvm::ConstantInt::get(int_type, 2166136261u);
+	for(int i=0; i<num_params; i++)
+		hash=Builder->CreateMul(Builder->CreateXor(hash, args[i]),
+				llvm::ConstantInt::get(int_type, 16777619));
+	hash=Builder->CreateXor(hash, Builder->CreateLShr(hash, 16));
+	llvm::Value *index=Builder->CreateAnd(hash,
+			llvm::ConstantInt::get(int_type, (1<<MEMO_CACHE_BITS)-1), "memo_index");
+
+	llvm::SmallVector<llvm::Value*, MEMO_MAX_PARAMS+2> slots;
+	for(int i=0; i<num_params+2; i++){
+		llvm::Value *indices[]={llvm::ConstantInt::get(int_type, 0), index,
+				llvm::ConstantInt::get(int_type, i)};
+		slots.push_back(Builder->CreateInBoundsGEP(table, indices, "memo_slot"));
 	}
-	Builder->CreateRet(ret_v);
+
+	//フラグが立っていて引数が全て一致すればヒット
+	llvm::Value *hit=Builder->CreateICmpEQ(Builder->CreateLoad(slots[0]),
+			llvm::ConstantInt::get(int_type, 1));
+	for(int i=0; i<num_params; i++)
+		hit=Builder->CreateAnd(hit,
+				Builder->CreateICmpEQ(Builder->CreateLoad(slots[i+1]), args[i]));
+	Builder->CreateCondBr(hit, hit_block, miss_block);
+
+	Builder->SetInsertPoint(hit_block);
+	Builder->CreateStore(Builder->CreateAdd(Builder->CreateLoad(hits),
+				llvm::ConstantInt::get(count_type, 1)), hits);
+	Builder->CreateRet(Builder->CreateLoad(slots[num_params+1], "memo_value"));
+
+	Builder->SetInsertPoint(miss_block);
+	llvm::CallInst *value=Builder->CreateCall(body, args, "call_tmp");
+	value->setCallingConv(body->getCallingConv());
+	Builder->CreateStore(llvm::ConstantInt::get(int_type, 1), slots[0]);
+	for(int i=0; i<num_params; i++)
+		Builder->CreateStore(args[i], slots[i+1]);
+	Builder->CreateStore(value, slots[num_params+1]);
+	Builder->CreateRet(value);
+
+	return body;
+}
+
+
+/**
+  * ヒット率を表示する関数の生成メソッド
+  * メモ化した関数ごとにヒット回数，呼び出し回数，ヒット率を標準エラー出力に書く
+  */
+void CodeGen::generateMemoReport(){
+	llvm::LLVMContext &context=llvm::getGlobalContext();
+	llvm::Type *int_type=llvm::Type::getInt32Ty(context);
+	llvm::Type *count_type=llvm::Type::getInt64Ty(context);
+
+	//int dprintf(int fd, const char *format, ...)
+	//(プログラムが別の型でdprintfを宣言していても，この型にキャストして呼び出す)
+	llvm::Type *param_types[]={int_type, llvm::Type::getInt8PtrTy(context)};
+	llvm::Constant *print_func=Mod->getOrInsertFunction("dprintf",
+			llvm::FunctionType::get(int_type, param_types, true));
+
+	llvm::BasicBlock *bblock=llvm::BasicBlock::Create(context, "entry", MemoReport);
+	Builder->SetInsertPoint(bblock);
+	llvm::Value *format=Builder->CreateGlobalStringPtr(
+			"memo %s : %llu hits / %llu calls (%llu%%)\n", "memo_format");
+	for(int i=0; i<MemoNames.size(); i++){
+		llvm::Value *hits_v=Builder->CreateLoad(MemoHits[i], "memo_hits");
+		llvm::Value *calls_v=Builder->CreateLoad(MemoCalls[i], "memo_calls");
+		llvm::Value *divisor=Builder->CreateSelect(
+				Builder->CreateICmpEQ(calls_v, llvm::ConstantInt::get(count_type, 0)),
+				llvm::ConstantInt::get(count_type, 1), calls_v);
+		llvm::Value *rate=Builder->CreateUDiv(
+				Builder->CreateMul(hits_v, llvm::ConstantInt::get(count_type, 100)), divisor);
+		llvm::Value *print_args[]={llvm::ConstantInt::get(int_type, 2), format,
+				Builder->CreateGlobalStringPtr(getSymbolName(MemoNames[i]), "memo_name"),
+				hits_v, calls_v, rate};
+		Builder->CreateCall(print_func, print_args);
+	}
+	Builder->CreateRetVoid();
 }
 
 
 /**
   * 変数参照(load命令)生成メソッド
-  * @param VariableAST
+  * @param 変数の参照，変数のシンボルID
   * @return  生成したValueのポインタ
   */
-llvm::Value *CodeGen::generateVariable(VariableAST *var){
+llvm::Value *CodeGen::visitVariable(FlatRef ref, SymbolID var){
+	//共有ノード(次の代入までの参照)は関数内で1度だけloadする
+	if(AST->isShared()){
+		llvm::DenseMap<FlatRef, llvm::Value*>::iterator it=SharedValues.find(ref);
+		if(it!=SharedValues.end())
+			return it->second;
+	}
 	llvm::ValueSymbolTable &vs_table = CurFunc->getValueSymbolTable();
-	return Builder->CreateLoad(vs_table.lookup(var->getName()), "var_tmp");
+	llvm::Value *v=Builder->CreateLoad(vs_table.lookup(getSymbolName(var)), "var_tmp");
+	if(AST->isShared())
+		SharedValues[ref]=v;
+	return v;
 }
 
 
-llvm::Value *CodeGen::generateNumber(int value){
+llvm::Value *CodeGen::visitNumber(FlatRef, int value){
 	return llvm::ConstantInt::get(
 			llvm::Type::getInt32Ty(llvm::getGlobalContext()),
 			value);
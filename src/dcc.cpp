@@ -8,10 +8,18 @@
 #include "llvm/Support/PrettyStackTrace.h"
 #include "llvm/Support/Signals.h"
 #include "llvm/Support/TargetSelect.h"
+#include<cstring>
+#include<sys/stat.h>
+#include<sys/time.h>
+#include "charscan.hpp"
 #include "lexer.hpp"
 #include "AST.hpp"
 #include "parser.hpp"
+#include "simplify.hpp"
+#include "share.hpp"
+#include "inline.hpp"
 #include "codegen.hpp"
+#include "alloccount.hpp"
 
 
 /**
@@ -23,17 +31,39 @@ class OptionParser
 		std::string InputFileName;
 		std::string OutputFileName;
 		std::string LinkFileName;
+		std::string ASTCacheDir;
 		bool WithJit;
+		bool LexOnly;
+		bool Simplify;
+		bool ShareExpr;
+		bool PrintStats;
+		bool CountAllocs;
+		bool TailCallOpt;
+		bool Memoize;
+		int TokenWindow;
+		int InlineThreshold;
+		int LexThreads;
 		int Argc;
 		char **Argv;
 
 	public:
-		OptionParser(int argc, char **argv):Argc(argc), Argv(argv), WithJit(false){}
+		OptionParser(int argc, char **argv):Argc(argc), Argv(argv), WithJit(false), LexOnly(false), Simplify(true), ShareExpr(false), PrintStats(false), CountAllocs(false), TailCallOpt(false), Memoize(false), TokenWindow(0), InlineThreshold(INLINE_THRESHOLD), LexThreads(1){}
 		void printHelp();
 		std::string getInputFileName(){return InputFileName;} 		//入力ファイル名取得
 		std::string getOutputFileName(){return OutputFileName;} 	//出力ファイル名取得
 		std::string getLinkFileName(){return LinkFileName;} 	//リンク用ファイル名取得
+		std::string getASTCacheDir(){return ASTCacheDir;} 	//ASTキャッシュの格納先ディレクトリ取得
 		bool getWithJit(){return WithJit;}		//JIT実行有無
+		bool getLexOnly(){return LexOnly;}		//字句解析のみ実行(スループット計測)
+		bool getSimplify(){return Simplify;}		//コード生成前の式の簡約有無
+		bool getShareExpr(){return ShareExpr;}		//同じ式のノードの共有有無
+		bool getPrintStats(){return PrintStats;}		//各段階の統計の表示有無
+		bool getCountAllocs(){return CountAllocs;}		//各段階のヒープ確保回数の表示有無
+		bool getTailCallOpt(){return TailCallOpt;}		//関数間の末尾呼び出しの除去を保証するか(fastcc)
+		bool getMemoize(){return Memoize;}		//関数を呼び出す純粋な関数のメモ化有無
+		int getTokenWindow(){return TokenWindow;}		//逐次字句解析時に保持するトークン数
+		int getInlineThreshold(){return InlineThreshold;}		//インライン展開する関数のノード数の上限(0で展開しない)
+		int getLexThreads(){return LexThreads;}		//字句解析・構文解析のスレッド数
 		bool parseOption();
 };
 
@@ -69,6 +99,30 @@ bool OptionParser::parseOption(){
 			LinkFileName.assign(Argv[++i]);
 		}else if(Argv[i][0]=='-' && Argv[i][1] == 'j' && Argv[i][2] == 'i' && Argv[i][3] == 't' && Argv[i][4] == '\0'){
 			WithJit = true;
+		}else if(strcmp(Argv[i], "-lex-only")==0){
+			LexOnly = true;
+		}else if(strcmp(Argv[i], "-token-window")==0 && i+1<Argc){
+			TokenWindow = atoi(Argv[++i]);
+		}else if(strcmp(Argv[i], "-no-simplify")==0){
+			Simplify = false;
+		}else if(strcmp(Argv[i], "-inline-threshold")==0 && i+1<Argc){
+			InlineThreshold = atoi(Argv[++i]);
+		}else if(strcmp(Argv[i], "-share-expr")==0){
+			ShareExpr = true;
+		}else if(strcmp(Argv[i], "-stats")==0){
+			PrintStats = true;
+		}else if(strcmp(Argv[i], "-tailcallopt")==0){
+			TailCallOpt = true;
+		}else if(strcmp(Argv[i], "-memoize")==0){
+			Memoize = true;
+		}else if(strcmp(Argv[i], "-count-allocs")==0){
+			CountAllocs = true;
+		}else if(strcmp(Argv[i], "-ast-cache")==0 && i+1<Argc){
+			ASTCacheDir.assign(Argv[++i]);
+		}else if(strcmp(Argv[i], "-threads")==0 && i+1<Argc){
+			LexThreads = atoi(Argv[++i]);
+			if(LexThreads<1)
+				LexThreads = 1;
 		}else if(Argv[i][0]=='-'){
 			fprintf(stderr,"%s は不明なオプションです\n", Argv[i]);
 			return false;
@@ -94,6 +148,60 @@ bool OptionParser::parseOption(){
 }
 
 
+/**
+ * 現在時刻取得(秒)
+ */
+static double getTime(){
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+
+/**
+ * 字句解析のみを実行し，文字種別走査の実装ごとにスループットを表示
+ * @param 入力ファイル名，スレッド数
+ * @return 成功時：true　失敗時：false
+ */
+static bool runLexBenchmark(std::string filename, int num_threads){
+	struct stat st;
+	if(stat(filename.c_str(), &st)!=0){
+		fprintf(stderr, "%s を開けません\n", filename.c_str());
+		return false;
+	}
+	double mbytes=st.st_size/(1024.0*1024.0);
+
+	ScanMode modes[]={SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2};
+	for(int i=0; i<sizeof(modes)/sizeof(modes[0]); i++){
+		if(!setScanMode(modes[i])){
+			fprintf(stdout, "%-6s : not supported\n", getScanModeName(modes[i]));
+			continue;
+		}
+
+		//warmup
+		TokenStream *tokens=LexicalAnalysis(filename, 0, num_threads);
+		if(!tokens)
+			return false;
+		SAFE_DELETE(tokens);
+
+		//0.5秒以上かつ5回以上計測
+		int runs=0;
+		double elapsed=0;
+		while(runs<5 || elapsed<0.5){
+			double start=getTime();
+			tokens=LexicalAnalysis(filename, 0, num_threads);
+			elapsed+=getTime()-start;
+			SAFE_DELETE(tokens);
+			runs++;
+		}
+		fprintf(stdout, "%-6s : %10.2f MB/s (%d runs)\n",
+				getScanModeName(modes[i]), mbytes*runs/elapsed, runs);
+	}
+	setScanMode(SCAN_AUTO);
+	return true;
+}
+
+
 /**
  * main関数
  */
@@ -114,36 +222,109 @@ int main(int argc, char **argv) {
 		exit(1);
 	}
 
-	//lex and parse
-	Parser *parser=new Parser(opt.getInputFileName());
-	if(!parser->doParse()){
-		fprintf(stderr, "err at parser or lexer\n");
-		SAFE_DELETE(parser);
-		exit(1);
+	//lexer only
+	if(opt.getLexOnly()){
+		if(!runLexBenchmark(opt.getInputFileName(), opt.getLexThreads()))
+			exit(1);
+		return 0;
 	}
 
-	//get AST
-	TranslationUnitAST &tunit=parser->getAST();
-	if(tunit.empty()){
-		fprintf(stderr,"TranslationUnit is empty");
+	//AST cache (ソースのハッシュ値をファイル名にする)
+	std::string cache_file;
+	unsigned long long source_hash=0;
+	if(!opt.getASTCacheDir().empty() && hashSourceFile(opt.getInputFileName(), source_hash)){
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.ast", source_hash);
+		cache_file=opt.getASTCacheDir()+"/"+name;
+	}
+
+	//count heap allocations per phase
+	if(opt.getCountAllocs())
+		startAllocCounting();
+
+	FlatAST *ast=new FlatAST();
+	if(!cache_file.empty() && ast->load(cache_file, source_hash)){
+		reportAllocCount("cache");
+	}else{
+		//lex and parse
+		Parser *parser=new Parser(opt.getInputFileName(), opt.getTokenWindow(), opt.getLexThreads());
+		reportAllocCount("lex");
+		bool parsed=parser->doParse();
+		reportAllocCount("parse");
+		if(!parsed){
+			fprintf(stderr, "err at parser or lexer\n");
+			SAFE_DELETE(parser);
+			SAFE_DELETE(ast);
+			exit(1);
+		}
+
+		//get AST
+		bool built=ast->build(parser->getAST());
+		reportAllocCount("flatten");
 		SAFE_DELETE(parser);
+		if(!built){
+			fprintf(stderr, "err at flatten (too many nodes)\n");
+			SAFE_DELETE(ast);
+			exit(1);
+		}
+		if(!cache_file.empty() && !ast->save(cache_file, source_hash))
+			fprintf(stderr, "%s に書き込めません\n", cache_file.c_str());
+	}
+	if(ast->empty()){
+		fprintf(stderr,"TranslationUnit is empty");
+		SAFE_DELETE(ast);
 		exit(1);
 	}
 
+	//inline small leaf functions
+	if(opt.getInlineThreshold()>0){
+		Inliner inliner(opt.getInlineThreshold());
+		inliner.doInline(*ast);
+		reportAllocCount("inline");
+		if(opt.getPrintStats())
+			fprintf(stderr, "inline : %d calls inlined\n", inliner.getInlinedCalls());
+	}
+
+	//simplify
+	if(opt.getSimplify()){
+		Simplifier simplifier;
+		simplifier.doSimplify(*ast);
+		reportAllocCount("simplify");
+		if(opt.getPrintStats())
+			fprintf(stderr, "simplify : %d nodes removed\n", simplifier.getRemovedNodes());
+	}
+
+	//share common subexpressions
+	if(opt.getShareExpr()){
+		ExpressionSharer sharer;
+		sharer.doShare(*ast);
+		reportAllocCount("share");
+		if(opt.getPrintStats())
+			fprintf(stderr, "share : %d nodes shared, %ld bytes saved, %d instructions not emitted\n",
+					sharer.getSharedNodes(), sharer.getSavedBytes(), sharer.getSavedInstructions());
+	}
+
 	CodeGen *codegen=new CodeGen();
-	if(!codegen->doCodeGen(tunit, opt.getInputFileName(), 
-				opt.getLinkFileName(), opt.getWithJit()) ){
+	codegen->setGuaranteedTailCalls(opt.getTailCallOpt());
+	codegen->setMemoize(opt.getMemoize());
+	bool generated=codegen->doCodeGen(*ast, opt.getInputFileName(), 
+				opt.getLinkFileName(), opt.getWithJit());
+	reportAllocCount("codegen");
+	if(!generated){
 		fprintf(stderr, "err at codegen\n");
-		SAFE_DELETE(parser);
+		SAFE_DELETE(ast);
 		SAFE_DELETE(codegen);
 		exit(1);
 	}
+	if(opt.getMemoize() && opt.getPrintStats())
+		fprintf(stderr, "memoize : %d pure functions, %d memoized\n",
+				codegen->getPureFunctionNum(), codegen->getMemoizedFunctionNum());
 
 	//get Module
 	llvm::Module &mod=codegen->getModule();
 	if(mod.empty()){
 		fprintf(stderr,"Module is empty");
-		SAFE_DELETE(parser);
+		SAFE_DELETE(ast);
 		SAFE_DELETE(codegen);
 		exit(1);
 	}
@@ -160,9 +341,10 @@ int main(int argc, char **argv) {
 	pm.add(createPrintModulePass(&raw_stream));
 	pm.run(mod);
 	raw_stream.close();
+	reportAllocCount("passes");
 
 	//delete
-	SAFE_DELETE(parser);
+	SAFE_DELETE(ast);
 	SAFE_DELETE(codegen);
   
 	return 0;
@@ -0,0 +1,311 @@
+#include "inline.hpp"
+
+
+/**
+  * 実引数を使わないことを表す参照
+  * (NullExprは実引数にならない)
+  */
+#define NO_SUBSTITUTE FLAT_REF(NullExprID, 0)
+
+
+/**
+  * インライン展開実行
+  * 関数を定義順に処理し，変数宣言と文を組み替えた配列をFlatASTに戻す
+  * @param 対象のFlatAST
+  */
+void Inliner::doInline(FlatAST &ast){
+	//ExpressionSharerの後はノードが共有されているため書き換えない
+	if(Threshold<=0 || ast.isShared())
+		return;
+	AST=&ast;
+
+	for(int i=0; i<ast.getFunctionNum(); i++){
+		const FlatFunction &func=ast.getFunction(i);
+		FlatFunction body=func;
+		body.DeclBegin=Decls.size();
+		for(int j=0; j<func.NumDecls; j++)
+			Decls.push_back(ast.getVariableDecl(func.DeclBegin+j));
+
+		//展開した関数の文は呼び出しを含む文の前に積まれる
+		HasCall=false;
+		body.StmtBegin=Stmts.size();
+		for(int j=0; j<func.NumStmts; j++){
+			Hoistable=true;
+			FlatRef stmt=visitExpression(ast.getStatement(func.StmtBegin+j));
+			Stmts.push_back(stmt);
+		}
+		body.NumDecls=Decls.size()-body.DeclBegin;
+		body.NumStmts=Stmts.size()-body.StmtBegin;
+		Bodies.push_back(body);
+
+		if(!HasCall && isInlinable(body)){
+			SymbolID name=ast.getPrototype(body.Proto).Name;
+			if(name>=Callees.size())
+				Callees.resize(name+1, -1);
+			Callees[name]=i;
+		}
+	}
+
+	ast.swapStatements(Decls, Stmts);
+	for(int i=0; i<Bodies.size(); i++)
+		ast.setFunction(i, Bodies[i]);
+
+	Decls.clear();
+	Stmts.clear();
+	Bodies.clear();
+	Callees.clear();
+	AST=NULL;
+}
+
+
+/**
+  * 二項演算の子ノードの展開
+  * 左結合の長い式で再帰が深くならないよう，左辺の二項演算の連なりは反復で辿り，
+  * 最も内側の演算から順に右辺を展開する
+  * @param 二項演算の参照，FlatBinary
+  * @return 展開後の式の参照
+  */
+FlatRef Inliner::visitBinaryExpression(FlatRef ref, const FlatBinary &){
+	int spine_begin=SpineStack.size();
+	FlatRef node=ref;
+	while(true){
+		SpineStack.push_back(node);
+		const FlatBinary &bin=AST->getBinary(node);
+		if(bin.Op==AssignOp || FLAT_ID(bin.LHS)!=BinaryExprID)
+			break;
+		node=bin.LHS;
+	}
+
+	//ノードの追加で配列が再確保されるため先に写す
+	FlatBinary bin=AST->getBinary(node);
+
+	//assignment (lhs is variable)
+	FlatRef lhs=bin.LHS;
+	if(bin.Op!=AssignOp)
+		lhs=visitExpression(bin.LHS);
+
+	for(int i=SpineStack.size()-1; i>=spine_begin; i--){
+		node=SpineStack[i];
+		bin=AST->getBinary(node);
+		FlatRef rhs=visitExpression(bin.RHS);
+		if(lhs!=bin.LHS || rhs!=bin.RHS)
+			AST->setBinary(node, bin.Op, lhs, rhs);
+
+		//以降に評価される呼び出しの文を前に出すと代入の前に実行されてしまう
+		if(bin.Op==AssignOp)
+			Hoistable=false;
+		lhs=node;
+	}
+	SpineStack.resize(spine_begin);
+	return ref;
+}
+
+
+/**
+  * 関数呼び出しの展開
+  * 実引数を先に処理し，展開できる関数ならreturnする式に置き換える
+  * @param 関数呼び出しの参照，FlatCall
+  * @return 展開後の式の参照
+  */
+FlatRef Inliner::visitCallExpression(FlatRef ref, const FlatCall &call_expr){
+	FlatCall call=call_expr;
+	for(int i=0; i<call.NumArgs; i++){
+		unsigned int index=call.ArgBegin+i;
+		AST->setArg(index, visitExpression(AST->getArg(index)));
+	}
+
+	int callee=call.Callee<Callees.size() ? Callees[call.Callee] : -1;
+	if(Hoistable && callee>=0 &&
+			AST->getPrototype(Bodies[callee].Proto).NumParams==call.NumArgs){
+		InlinedCalls++;
+		return inlineCall(call, Bodies[callee]);
+	}
+
+	//展開しない呼び出しは副作用を持ち得る
+	Hoistable=false;
+	HasCall=true;
+	return ref;
+}
+
+
+/**
+  * ジャンプ文のreturnする式の展開
+  * @param ジャンプ文の参照，returnする式の参照
+  * @return ジャンプ文の参照
+  */
+FlatRef Inliner::visitJumpStatement(FlatRef ref, FlatRef expr){
+	FlatRef new_expr=visitExpression(expr);
+	if(new_expr!=expr)
+		AST->setJumpExpr(ref, new_expr);
+	return ref;
+}
+
+
+/**
+  * 関数本体の展開
+  * 実引数の代入と本体の文を現在の関数の文に積み，returnする式の複製を返す．
+  * 本体で代入しない引数に数値か変数を渡す場合は，引数の変数を作らず実引数で置き換える
+  * @param 関数呼び出し，展開する関数の本体(Decls，Stmtsの範囲)
+  * @return 呼び出しを置き換える式の参照
+  */
+FlatRef Inliner::inlineCall(const FlatCall &call_expr, const FlatFunction &func){
+	SymbolID func_name=AST->getPrototype(func.Proto).Name;
+	int num_params=call_expr.NumArgs;
+	unsigned int last=func.StmtBegin+func.NumStmts-1;
+
+	for(int i=0; i<func.NumDecls; i++){
+		FlatVariableDecl vdecl=Decls[func.DeclBegin+i];
+		if(vdecl.Name>=Renames.size()){
+			Renames.resize(vdecl.Name+1, 0);
+			Substitutes.resize(vdecl.Name+1, NO_SUBSTITUTE);
+		}
+		Substitutes[vdecl.Name]=NO_SUBSTITUTE;
+
+		//引数は関数の先頭の変数宣言から順に並ぶ
+		FlatRef arg=NO_SUBSTITUTE;
+		if(vdecl.Type==VariableDeclAST::param && i<num_params){
+			arg=AST->getArg(call_expr.ArgBegin+i);
+			if(FLAT_ID(arg)==NumberID || FLAT_ID(arg)==VariableID){
+				bool assigned=false;
+				for(unsigned int j=func.StmtBegin; j<=last && !assigned; j++)
+					assigned=isAssigned(Stmts[j], vdecl.Name);
+				if(!assigned){
+					Substitutes[vdecl.Name]=arg;
+					continue;
+				}
+			}
+		}
+
+		FlatVariableDecl local;
+		local.Name=makeLocalName(func_name, vdecl.Name);
+		local.Type=VariableDeclAST::local;
+		Decls.push_back(local);
+		Renames[vdecl.Name]=local.Name;
+		if(arg!=NO_SUBSTITUTE)
+			Stmts.push_back(AST->addBinary(AssignOp, AST->addVariable(local.Name), arg));
+	}
+
+	for(unsigned int i=func.StmtBegin; i<last; i++){
+		FlatRef stmt=Stmts[i];
+		if(FLAT_ID(stmt)!=NullExprID)
+			Stmts.push_back(copyExpression(stmt));
+	}
+	return copyExpression(AST->getJumpExpr(Stmts[last]));
+}
+
+
+/**
+  * 展開する関数の式の複製
+  * 左辺の二項演算の連なりは反復で辿り，最も内側の演算から順に複製する
+  * @param 複製する式の参照
+  * @return 複製した式の参照
+  */
+FlatRef Inliner::copyExpression(FlatRef expr){
+	int spine_begin=SpineStack.size();
+	while(FLAT_ID(expr)==BinaryExprID){
+		SpineStack.push_back(expr);
+		expr=AST->getBinary(expr).LHS;
+	}
+
+	FlatRef lhs=copyLeaf(expr);
+	for(int i=SpineStack.size()-1; i>=spine_begin; i--){
+		//ノードの追加で配列が再確保されるため先に写す
+		FlatBinary bin=AST->getBinary(SpineStack[i]);
+		FlatRef rhs=copyExpression(bin.RHS);
+		lhs=AST->addBinary(bin.Op, lhs, rhs);
+	}
+	SpineStack.resize(spine_begin);
+	return lhs;
+}
+
+
+/**
+  * 展開する関数の二項演算以外の式の複製
+  * 変数は改名後の変数か実引数の複製に置き換える
+  * @param 複製する式の参照
+  * @return 複製した式の参照
+  */
+FlatRef Inliner::copyLeaf(FlatRef expr){
+	switch(FLAT_ID(expr)){
+		case VariableID:{
+			SymbolID var=AST->getVariable(expr);
+			FlatRef arg=Substitutes[var];
+			if(arg==NO_SUBSTITUTE)
+				return AST->addVariable(Renames[var]);
+			else if(FLAT_ID(arg)==NumberID)
+				return AST->addNumber(AST->getNumber(arg));
+			else
+				return AST->addVariable(AST->getVariable(arg));
+		}
+		case NumberID:
+			return AST->addNumber(AST->getNumber(expr));
+		default:
+			//葉関数のみ展開するため関数呼び出し，ジャンプ文は現れない
+			return expr;
+	}
+}
+
+
+/**
+  * 関数を展開できるか
+  * 最後の文のみがreturnで，本体のノード数が閾値以下であること
+  * @param 関数本体(Decls，Stmtsの範囲)
+  * @return 展開できる：true　展開できない：false
+  */
+bool Inliner::isInlinable(const FlatFunction &func){
+	if(func.NumStmts==0 || FLAT_ID(Stmts[func.StmtBegin+func.NumStmts-1])!=JumpStmtID)
+		return false;
+
+	FlatNodeCounter counter(AST);
+	int num_nodes=0;
+	for(int i=0; i<func.NumStmts; i++){
+		FlatRef stmt=Stmts[func.StmtBegin+i];
+		if(i<func.NumStmts-1 && FLAT_ID(stmt)==JumpStmtID)
+			return false;
+		num_nodes+=counter.visitExpression(stmt);
+		if(num_nodes>Threshold)
+			return false;
+	}
+	return true;
+}
+
+
+/**
+  * 式の中で変数に代入しているか
+  * 左辺の二項演算の連なりは反復で辿り，右辺のみ再帰する
+  * @param 式の参照，変数のシンボルID
+  * @return 代入している：true　代入していない：false
+  */
+bool Inliner::isAssigned(FlatRef expr, SymbolID var){
+	while(true){
+		switch(FLAT_ID(expr)){
+			case BinaryExprID:{
+				const FlatBinary &bin=AST->getBinary(expr);
+				if(bin.Op==AssignOp && AST->getVariable(bin.LHS)==var)
+					return true;
+				if(isAssigned(bin.RHS, var))
+					return true;
+				expr=bin.LHS;
+				break;
+			}
+			case JumpStmtID:
+				expr=AST->getJumpExpr(expr);
+				break;
+			default:
+				return false;
+		}
+	}
+}
+
+
+/**
+  * 展開先の局所変数名の作成
+  * DummyCの識別子に使えない'.'で区切り，呼び出しごとの番号を付ける
+  * @param 展開する関数のシンボルID，変数のシンボルID
+  * @return 局所変数のシンボルID
+  */
+SymbolID Inliner::makeLocalName(SymbolID func_name, SymbolID var){
+	char suffix[16];
+	snprintf(suffix, sizeof(suffix), ".%d", InlinedCalls);
+	return internSymbol(getSymbolName(func_name)+"."+getSymbolName(var)+suffix);
+}
@@ -1,163 +1,737 @@
 #include "lexer.hpp"
+#include<algorithm>
+#include<cstring>
+#include<fcntl.h>
+#include<pthread.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<unistd.h>
+
+
+
+/************************************************
+字句解析用DFA
+************************************************/
+
+/**
+  * 文字クラス
+  */
+enum CharClass{
+	CC_OTHER,		//解析不能字句
+	CC_SPACE,		//空白
+	CC_NEWLINE,		//改行
+	CC_ALPHA,		//英字
+	CC_ZERO,		//'0'
+	CC_DIGIT,		//'1'-'9'
+	CC_SLASH,		//'/'
+	CC_STAR,		//'*'
+	CC_SYMBOL,		//その他の記号
+	CC_EOF,			//入力終端
+	NUM_CHAR_CLASS
+};
+
+
+/**
+  * DFAの状態
+  */
+enum LexState{
+	LS_START,			//初期状態
+	LS_SPACE,			//空白
+	LS_IDENT,			//識別子
+	LS_ZERO,			//数字'0'
+	LS_NUMBER,			//数字
+	LS_SLASH,			//'/'
+	LS_SYMBOL,			//記号
+	LS_LINE_COMMENT,	//コメント(//)
+	LS_BLOCK_COMMENT,	//コメント(/* */)
+	LS_BLOCK_STAR,		//コメント(/* */)中の'*'
+	LS_ERROR,			//解析不能字句
+	NUM_LEX_STATE
+};
+
+
+/**
+  * 遷移表の各要素は下位ビットが次状態，上位ビットが動作
+  * ACT_EMIT  : 現在の文字の直前までを現状態のトークンとして切り出す
+  * ACT_BEGIN : 現在の文字から新しいトークンを開始する
+  */
+#define ACT_EMIT 0x80
+#define ACT_BEGIN 0x40
+#define LEX_STATE_MASK 0x3f
+
+#define B(s) (ACT_BEGIN|(s))
+#define E(s) (ACT_EMIT|(s))
+#define EB(s) (ACT_EMIT|ACT_BEGIN|(s))
+
+#define O CC_OTHER
+#define S CC_SPACE
+#define N CC_NEWLINE
+#define A CC_ALPHA
+#define Z CC_ZERO
+#define D CC_DIGIT
+#define L CC_SLASH
+#define T CC_STAR
+#define Y CC_SYMBOL
+
+/**
+  * 文字クラス表
+  */
+static const unsigned char CharClassTable[256]={
+/*	    0  1  2  3  4  5  6  7  8  9  a  b  c  d  e  f	*/
+/*0*/	O, O, O, O, O, O, O, O, O, S, N, S, S, S, O, O,
+/*1*/	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+/*2*/	S, O, O, O, O, O, O, O, Y, Y, T, Y, Y, Y, O, L,
+/*3*/	Z, D, D, D, D, D, D, D, D, D, O, Y, O, Y, O, O,
+/*4*/	O, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A,
+/*5*/	A, A, A, A, A, A, A, A, A, A, A, O, O, O, O, O,
+/*6*/	O, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A,
+/*7*/	A, A, A, A, A, A, A, A, A, A, A, Y, O, Y, O, O,
+/*8*/	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+/*9*/	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+/*a*/	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+/*b*/	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+/*c*/	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+/*d*/	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+/*e*/	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+/*f*/	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O
+};
+
+#undef O
+#undef S
+#undef N
+#undef A
+#undef Z
+#undef D
+#undef L
+#undef T
+#undef Y
+
+
+/**
+  * 状態遷移表
+  * トークンの終端では，切り出しと同時に初期状態からの遷移先へ直接進む
+  */
+static const unsigned char TransitionTable[NUM_LEX_STATE][NUM_CHAR_CLASS]={
+/*				OTHER			SPACE			NEWLINE			ALPHA			ZERO			DIGIT			SLASH				STAR				SYMBOL			EOF			*/
+/*START*/		{LS_ERROR,		LS_SPACE,		LS_SPACE,		B(LS_IDENT),	B(LS_ZERO),		B(LS_NUMBER),	B(LS_SLASH),		B(LS_SYMBOL),		B(LS_SYMBOL),	LS_START},
+/*SPACE*/		{LS_ERROR,		LS_SPACE,		LS_SPACE,		B(LS_IDENT),	B(LS_ZERO),		B(LS_NUMBER),	B(LS_SLASH),		B(LS_SYMBOL),		B(LS_SYMBOL),	LS_START},
+/*IDENT*/		{E(LS_ERROR),	E(LS_SPACE),	E(LS_SPACE),	LS_IDENT,		LS_IDENT,		LS_IDENT,		EB(LS_SLASH),		EB(LS_SYMBOL),		EB(LS_SYMBOL),	E(LS_START)},
+/*ZERO*/		{E(LS_ERROR),	E(LS_SPACE),	E(LS_SPACE),	EB(LS_IDENT),	EB(LS_ZERO),	EB(LS_NUMBER),	EB(LS_SLASH),		EB(LS_SYMBOL),		EB(LS_SYMBOL),	E(LS_START)},
+/*NUMBER*/		{E(LS_ERROR),	E(LS_SPACE),	E(LS_SPACE),	EB(LS_IDENT),	LS_NUMBER,		LS_NUMBER,		EB(LS_SLASH),		EB(LS_SYMBOL),		EB(LS_SYMBOL),	E(LS_START)},
+/*SLASH*/		{E(LS_ERROR),	E(LS_SPACE),	E(LS_SPACE),	EB(LS_IDENT),	EB(LS_ZERO),	EB(LS_NUMBER),	LS_LINE_COMMENT,	LS_BLOCK_COMMENT,	EB(LS_SYMBOL),	E(LS_START)},
+/*SYMBOL*/		{E(LS_ERROR),	E(LS_SPACE),	E(LS_SPACE),	EB(LS_IDENT),	EB(LS_ZERO),	EB(LS_NUMBER),	EB(LS_SLASH),		EB(LS_SYMBOL),		EB(LS_SYMBOL),	E(LS_START)},
+/*LINE*/		{LS_LINE_COMMENT,	LS_LINE_COMMENT,	LS_SPACE,	LS_LINE_COMMENT,	LS_LINE_COMMENT,	LS_LINE_COMMENT,	LS_LINE_COMMENT,	LS_LINE_COMMENT,	LS_LINE_COMMENT,	LS_START},
+/*BLOCK*/		{LS_BLOCK_COMMENT,	LS_BLOCK_COMMENT,	LS_BLOCK_COMMENT,	LS_BLOCK_COMMENT,	LS_BLOCK_COMMENT,	LS_BLOCK_COMMENT,	LS_BLOCK_COMMENT,	LS_BLOCK_STAR,	LS_BLOCK_COMMENT,	LS_START},
+/*BSTAR*/		{LS_BLOCK_COMMENT,	LS_BLOCK_COMMENT,	LS_BLOCK_COMMENT,	LS_BLOCK_COMMENT,	LS_BLOCK_COMMENT,	LS_BLOCK_COMMENT,	LS_START,	LS_BLOCK_STAR,	LS_BLOCK_COMMENT,	LS_START},
+/*ERROR*/		{LS_ERROR,		LS_ERROR,		LS_ERROR,		LS_ERROR,		LS_ERROR,		LS_ERROR,		LS_ERROR,			LS_ERROR,			LS_ERROR,		LS_ERROR}
+};
+
+#undef B
+#undef E
+#undef EB
+
+
+/**
+  * 切り出し時の状態に対応するトークン種別
+  */
+static const TokenType StateTokenTable[NUM_LEX_STATE]={
+	TOK_EOF, TOK_EOF, TOK_IDENTIFIER, TOK_DIGIT, TOK_DIGIT,
+	TOK_SLASH, TOK_EOF, TOK_EOF, TOK_EOF, TOK_EOF, TOK_EOF
+};
+
+
+/**
+  * 記号のトークン種別
+  * @param 記号
+  * @return トークン種別
+  */
+static inline TokenType getSymbolTokenType(char c){
+	switch(c){
+		case '+': return TOK_PLUS;
+		case '-': return TOK_MINUS;
+		case '*': return TOK_STAR;
+		case '/': return TOK_SLASH;
+		case '=': return TOK_ASSIGN;
+		case ';': return TOK_SEMICOLON;
+		case ',': return TOK_COMMA;
+		case '(': return TOK_LPAREN;
+		case ')': return TOK_RPAREN;
+		case '{': return TOK_LBRACE;
+		case '}': return TOK_RBRACE;
+		default: return TOK_EOF;
+	}
+}
+
+
+/**
+  * 状態ごとの連続部分の読み飛ばし方法(CharScanner使用時)
+  */
+enum RunKind{
+	RUN_NONE,
+	RUN_SPACE,
+	RUN_ALNUM,
+	RUN_DIGIT,
+	RUN_LINE,
+	RUN_BLOCK
+};
+
+static const unsigned char StateRunTable[NUM_LEX_STATE]={
+	RUN_NONE, RUN_SPACE, RUN_ALNUM, RUN_NONE, RUN_DIGIT,
+	RUN_NONE, RUN_NONE, RUN_LINE, RUN_BLOCK, RUN_NONE, RUN_NONE
+};
+
+
+/**
+  * 予約語表
+  * (長さ + 先頭文字) & KEYWORD_HASH_MASK が予約語ごとに異なるよう配置した完全ハッシュ
+  * 予約語を追加する際は衝突しない位置に置き，必要ならマスクを広げる
+  */
+#define KEYWORD_HASH_MASK 7
+
+struct Keyword{
+	const char *Name;
+	int Length;
+	TokenType Type;
+};
+
+static const Keyword KeywordTable[KEYWORD_HASH_MASK+1]={
+	/*0*/{"return", 6, TOK_RETURN},		//(6+'r')&7 = 0
+	/*1*/{NULL, 0, TOK_IDENTIFIER},
+	/*2*/{NULL, 0, TOK_IDENTIFIER},
+	/*3*/{NULL, 0, TOK_IDENTIFIER},
+	/*4*/{"int", 3, TOK_INT},			//(3+'i')&7 = 4
+	/*5*/{NULL, 0, TOK_IDENTIFIER},
+	/*6*/{NULL, 0, TOK_IDENTIFIER},
+	/*7*/{NULL, 0, TOK_IDENTIFIER}
+};
+
+
+/**
+  * 識別子が予約語か判定
+  * @param 識別子の先頭，長さ
+  * @return 予約語の場合はそのトークン種別，それ以外はTOK_IDENTIFIER
+  */
+static inline TokenType lookupKeyword(const char *str, int length){
+	const Keyword &kw=KeywordTable[(length+str[0]) & KEYWORD_HASH_MASK];
+	if(kw.Length==length && memcmp(kw.Name, str, length)==0)
+		return kw.Type;
+	return TOK_IDENTIFIER;
+}
+
+
+/**
+  * 切り出したトークンを生成
+  * @param 切り出し時の状態, バッファ, 開始位置, 長さ, 行番号, 識別子の登録先
+  * @return Token
+  */
+static inline Token makeToken(int state, const char *buf,
+		int begin, int length, int line, SymbolInterner *interner){
+	TokenType type=StateTokenTable[state];
+	if(type==TOK_IDENTIFIER){
+		type=lookupKeyword(buf+begin, length);
+		if(type==TOK_IDENTIFIER)
+			return Token(type, begin, length, line, (int)interner->intern(buf+begin, length));
+		else
+			return Token(type, begin, length, line);
+
+	//バッファから直接数値に変換
+	}else if(type==TOK_DIGIT){
+		int number=0;
+		for(int i=begin; i<begin+length; i++)
+			number=number*10+(buf[i]-'0');
+		return Token(TOK_DIGIT, begin, length, line, number);
+
+	}else if(state==LS_SYMBOL){
+		return Token(getSymbolTokenType(buf[begin]), begin, length, line);
+
+	}else{
+		return Token(type, begin, length, line);
+	}
+}
+
+
+
+/**
+  * コンストラクタ
+  * @param 字句解析対象のSourceBuffer
+  */
+Lexer::Lexer(SourceBuffer *source)
+	: Buf(source->getData()), Length(source->getSize()), Index(0), Begin(0), Line(0),
+	State(LS_START), Interner(&getInterner()), Finished(false), Error(false){
+	Scan=&getCharScanner();
+	UseScanner=(getScanMode()!=SCAN_SCALAR);
+}
+
+
+/**
+  * コンストラクタ(範囲指定)
+  * SourceBufferの[begin, end)のみを字句解析する
+  * beginはコメント外の行頭であること
+  * @param 字句解析対象のSourceBuffer，開始位置，終了位置，開始位置の行番号，識別子の登録先
+  */
+Lexer::Lexer(SourceBuffer *source, int begin, int end, int line, SymbolInterner *interner)
+	: Buf(source->getData()), Length(end), Index(begin), Begin(begin), Line(line),
+	State(LS_START), Interner(interner), Finished(false), Error(false){
+	Scan=&getCharScanner();
+	UseScanner=(getScanMode()!=SCAN_SCALAR);
+}
+
+
+/**
+  * 解析不能字句のエラー表示
+  */
+void Lexer::printError(){
+	if(Error)
+		fprintf(stderr, "unclear token : %c", Buf[Index]);
+}
+
+
+/**
+  * トークンを1つ切り出す
+  * 1文字ごとに文字クラス表と状態遷移表を1回ずつ引いて状態を進める
+  * SIMD版のCharScannerが使える場合は，空白・コメント・識別子・数字の連続部分をまとめて読み飛ばす
+  * @param 切り出したトークンの格納先
+  * @return 切り出し成功時：true　EOF切り出し後または解析不能字句：false
+  */
+bool Lexer::lexToken(Token &token){
+	if(Finished)
+		return false;
+
+	while(Index<Length){
+		int cls=CharClassTable[(unsigned char)Buf[Index]];
+		int action=TransitionTable[State][cls];
+		bool emitted=false;
+
+		if(action & ACT_EMIT){
+			token=makeToken(State, Buf, Begin, Index-Begin, Line, Interner);
+			emitted=true;
+		}
+		if(action & ACT_BEGIN)
+			Begin=Index;
+		Line+=(cls==CC_NEWLINE);
+		State=action & LEX_STATE_MASK;
+
+		//解析不能字句
+		if(State==LS_ERROR){
+			Error=true;
+			Finished=true;
+			return false;
+		}
+		Index++;
+
+		//連続部分の読み飛ばし
+		if(UseScanner){
+			switch(StateRunTable[State]){
+				case RUN_SPACE:
+					Index=Scan->skipSpace(Buf, Index, Length, &Line);
+					break;
+				case RUN_ALNUM:
+					Index=Scan->skipAlnum(Buf, Index, Length);
+					break;
+				case RUN_DIGIT:
+					Index=Scan->skipDigit(Buf, Index, Length);
+					break;
+				case RUN_LINE:
+					Index=Scan->skipLine(Buf, Index, Length);
+					break;
+				case RUN_BLOCK:
+					Index=Scan->skipBlockComment(Buf, Index, Length, &Line);
+					State=LS_START;
+					break;
+				default:
+					break;
+			}
+		}
+
+		if(emitted)
+			return true;
+	}
+
+	//終端のトークン
+	if(TransitionTable[State][CC_EOF] & ACT_EMIT){
+		token=makeToken(State, Buf, Begin, Index-Begin, Line, Interner);
+		State=LS_START;
+		return true;
+	}
+
+	//EOF
+	token=Token(TOK_EOF, Length, 0, Line);
+	Finished=true;
+	return true;
+}
+
+
+
+/************************************************
+並列字句解析
+************************************************/
+
+/**
+  * 並列字句解析で1スレッドが担当する最小のバイト数
+  */
+#define MIN_LEX_CHUNK_SIZE (64*1024)
+
+
+/**
+  * 並列字句解析の分割単位
+  */
+struct LexChunk{
+	SourceBuffer *Source;
+	int Begin;					//開始位置(コメント外の行頭)
+	int End;					//終了位置
+	int Line;					//開始位置の行番号
+	std::vector<Token> Tokens;	//切り出したトークン(識別子はInternerのローカルID)
+	SymbolInterner Interner;	//チャンク内の識別子
+	Lexer *Lex;
+};
+
+
+/**
+  * 1行分の走査
+  * コメントの状態のみを追い，次の行頭まで進める
+  * @param バッファ，開始位置，長さ，ブロックコメント中か(走査後の状態を格納)
+  * @return 次の行頭の位置(改行がない場合は長さ)
+  */
+static int scanLine(const char *buf, int index, int length, bool &in_comment){
+	bool line_comment=false;
+	for(; index<length; index++){
+		char c=buf[index];
+		if(c=='\n')
+			return index+1;
+		if(line_comment)
+			continue;
+		if(in_comment){
+			if(c=='*' && index+1<length && buf[index+1]=='/'){
+				in_comment=false;
+				index++;
+			}
+		}else if(c=='/' && index+1<length){
+			if(buf[index+1]=='/'){
+				line_comment=true;
+				index++;
+			}else if(buf[index+1]=='*'){
+				in_comment=true;
+				index++;
+			}
+		}
+	}
+	return length;
+}
+
+
+/**
+  * 分割位置の探索
+  * ブロックコメントの外にある行頭を，ほぼ均等な間隔で最大num_chunks-1個選ぶ
+  * @param バッファ，長さ，分割数，分割位置の格納先，分割位置の行番号の格納先
+  */
+static void findChunkBoundaries(const char *buf, int length, int num_chunks,
+		std::vector<int> &begins, std::vector<int> &lines){
+	bool in_comment=false;
+	int line=0;
+	int index=0;
+
+	begins.push_back(0);
+	lines.push_back(0);
+	while(begins.size()<num_chunks){
+		index=scanLine(buf, index, length, in_comment);
+		if(index>=length)
+			break;
+		line++;
+		if(!in_comment && index>=(long long)length*begins.size()/num_chunks){
+			begins.push_back(index);
+			lines.push_back(line);
+		}
+	}
+}
+
+
+/**
+  * チャンクの字句解析(ワーカスレッド)
+  * 最後のチャンク以外はEOFを含めない
+  */
+static void *lexChunk(void *arg){
+	LexChunk *chunk=static_cast<LexChunk*>(arg);
+	Token token;
+	while(chunk->Lex->lexToken(token)){
+		if(token.getTokenType()==TOK_EOF && chunk->End!=chunk->Source->getSize())
+			break;
+		chunk->Tokens.push_back(token);
+	}
+	return NULL;
+}
+
+
+/**
+  * 並列字句解析
+  * 入力を分割位置で区切って各スレッドで字句解析し，先頭から順に連結する
+  * 識別子はチャンク順に全体のSymbolInternerへ登録し直すため，
+  * シンボルIDを含め逐次の字句解析と同じ結果になる
+  * @param 格納先TokenStream，SourceBuffer，スレッド数
+  * @return 成功時：true　解析不能字句：false
+  */
+static bool lexParallel(TokenStream *tokens, SourceBuffer *source, int num_threads){
+	std::vector<int> begins;
+	std::vector<int> lines;
+	findChunkBoundaries(source->getData(), source->getSize(), num_threads, begins, lines);
+
+	int num_chunks=begins.size();
+	std::vector<LexChunk*> chunks(num_chunks);
+	for(int i=0; i<num_chunks; i++){
+		LexChunk *chunk=new LexChunk();
+		chunk->Source=source;
+		chunk->Begin=begins[i];
+		chunk->End=(i+1<num_chunks) ? begins[i+1] : source->getSize();
+		chunk->Line=lines[i];
+		chunk->Lex=new Lexer(source, chunk->Begin, chunk->End, chunk->Line, &chunk->Interner);
+		chunks[i]=chunk;
+	}
+
+	//先頭チャンクは呼び出し元スレッドで処理
+	std::vector<pthread_t> threads(num_chunks);
+	std::vector<bool> started(num_chunks, false);
+	for(int i=1; i<num_chunks; i++)
+		started[i]=(pthread_create(&threads[i], NULL, lexChunk, chunks[i])==0);
+	lexChunk(chunks[0]);
+	for(int i=1; i<num_chunks; i++){
+		if(started[i])
+			pthread_join(threads[i], NULL);
+		else
+			lexChunk(chunks[i]);
+	}
+
+	//連結
+	bool result=true;
+	for(int i=0; i<num_chunks && result; i++){
+		LexChunk *chunk=chunks[i];
+		std::vector<SymbolID> remap(chunk->Interner.size());
+		for(int id=0; id<chunk->Interner.size(); id++)
+			remap[id]=internSymbol(chunk->Interner.getName(id));
+
+		for(int j=0; j<chunk->Tokens.size(); j++){
+			Token &token=chunk->Tokens[j];
+			if(token.getTokenType()==TOK_IDENTIFIER)
+				token=Token(TOK_IDENTIFIER, token.getOffset(), token.getLength(),
+						token.getLine(), (int)remap[token.getSymbol()]);
+			tokens->pushToken(token);
+		}
+
+		//解析不能字句
+		if(chunk->Lex->hasError()){
+			chunk->Lex->printError();
+			result=false;
+		}
+	}
+
+	for(int i=0; i<num_chunks; i++){
+		SAFE_DELETE(chunks[i]->Lex);
+		SAFE_DELETE(chunks[i]);
+	}
+	return result;
+}
 
 
 
 /**
  * トークン切り出し関数
- * @param 字句解析対象ファイル名
+ * ファイル全体をmmapしたバッファを先頭から走査し，
+ * 各トークンはバッファ中のオフセットと長さで保持する
+ * window_sizeを指定した場合は先読みせず，構文解析の進行に合わせて逐次切り出す
+ * num_threadsが2以上の場合は入力を分割して並列に切り出す(一括切り出し時のみ)
+ * @param 字句解析対象ファイル名，逐次切り出し時に保持するトークン数(0の場合は一括で切り出す)，スレッド数
  * @return 切り出したトークンを格納したTokenStream
  */
-TokenStream *LexicalAnalysis(std::string input_filename){
-	TokenStream *tokens=new TokenStream();
-	std::ifstream ifs;
-	std::string cur_line;
-	std::string token_str;
-	int line_num=0;
-	bool iscomment=false;
-
-	ifs.open(input_filename.c_str(), std::ios::in);
-	if(!ifs)
+TokenStream *LexicalAnalysis(std::string input_filename, int window_size, int num_threads){
+	SourceBuffer *source=new SourceBuffer();
+	if(!source->open(input_filename)){
+		SAFE_DELETE(source);
 		return NULL;
-	while(ifs && getline(ifs, cur_line)){
-		char next_char;
-		std::string line;
-		Token *next_token;
-		int index=0;				
-		int length=cur_line.length();
-	
-		while(index<length){	
-			next_char = cur_line.at(index++);
-
-			//コメントアウト読み飛ばし
-			if(iscomment){
-				if( (length-index) < 2 
-					||	(cur_line.at(index) != '*') 
-					|| (cur_line.at(index++) != '/') ){
-					continue;
-				}else{
-					iscomment=false;
-				}
-			}
-		
-			//EOF
-			if(next_char == EOF){
-				token_str = EOF;
-				next_token = new Token(token_str, TOK_EOF, line_num);
-		
-			}else if(isspace(next_char)){
-				continue;
-
-			//IDENTIFIER
-			}else if(isalpha(next_char)){
-				token_str += next_char;
-				next_char = cur_line.at(index++);
-				while(isalnum(next_char)){
-					token_str += next_char;
-					next_char = cur_line.at(index++);
-					if(index==length)
-						break;
-				}
-				index--;
-		
-				if(token_str == "int"){
-					next_token = new Token(token_str, TOK_INT, line_num);
-				}else if(token_str == "return"){
-					next_token = new Token(token_str, TOK_RETURN, line_num);
-				}else{
-					next_token = new Token(token_str, TOK_IDENTIFIER, line_num);
-				}
-		
-			//数字
-			}else if(isdigit(next_char)){
-				if(next_char=='0'){
-					token_str += next_char;
-					next_token = new Token(token_str, TOK_DIGIT, line_num);
-				}else{
-					token_str += next_char;
-					next_char = cur_line.at(index++);
-					while(isdigit(next_char)){
-						token_str += next_char;
-						next_char = cur_line.at(index++);
-					}
-					next_token = new Token(token_str, TOK_DIGIT, line_num);
-					index--;
-				}
-		
-			//コメント or '/'
-			}else if(next_char == '/'){
-				token_str += next_char;
-				next_char = cur_line.at(index++);
-
-				//コメントの場合
-				if(next_char == '/'){
-						break;
-		
-				//コメントの場合
-				}else if(next_char == '*'){
-					iscomment=true;
-					continue;
-		
-				//DIVIDER('/')
-				}else{
-					index--;
-					next_token = new Token(token_str, TOK_SYMBOL, line_num);
-				}
-		
-			//それ以外(記号)
-			}else{
-				if(next_char == '*' ||
-						next_char == '+' ||
-						next_char == '-' ||
-						next_char == '=' ||
-						next_char == ';' ||
-						next_char == ',' ||
-						next_char == '(' ||
-						next_char == ')' ||
-						next_char == '{' ||
-						next_char == '}'){
-					token_str += next_char;
-					next_token = new Token(token_str, TOK_SYMBOL, line_num);
-
-				//解析不能字句
-				}else{
-					fprintf(stderr, "unclear token : %c", next_char);
-					SAFE_DELETE(tokens);
-					return NULL;
-				}
-			}
-		
-			//Tokensに追加
-			tokens->pushToken(next_token);
-			token_str.clear();
-		}
+	}
 
-		token_str.clear();
-		line_num++;
+	//逐次切り出し
+	if(window_size>0){
+		TokenStream *tokens=new TokenStream(source, window_size);
+		if(tokens->hasError())
+			SAFE_DELETE(tokens);
+		return tokens;
 	}
 
+	//並列切り出し
+	TokenStream *tokens=new TokenStream(source);
+	num_threads=std::min<int>(num_threads, source->getSize()/MIN_LEX_CHUNK_SIZE);
+	if(num_threads>1){
+		if(!lexParallel(tokens, source, num_threads))
+			SAFE_DELETE(tokens);
+		return tokens;
+	}
 
-	//EOFの確認
-	if(ifs.eof()){
-		tokens->pushToken(
-				new Token(token_str, TOK_EOF, line_num)
-				);
+	//一括切り出し
+	Lexer lexer(source);
+	Token token;
+	while(lexer.lexToken(token)){
+		tokens->pushToken(token);
+	}
+	if(lexer.hasError()){
+		lexer.printError();
+		SAFE_DELETE(tokens);
+		return NULL;
 	}
 
-	//クローズ
-	ifs.close();
 	return tokens;
 }
-	
+
+
+
+/**
+  * ソースファイルのオープン
+  * ファイル全体をmmapする．mmapできない場合はバッファに読み込む
+  * @param ファイル名
+  * @return 成功時：true　失敗時：false
+  */
+bool SourceBuffer::open(std::string filename){
+	int fd=::open(filename.c_str(), O_RDONLY);
+	if(fd<0)
+		return false;
+
+	struct stat st;
+	if(fstat(fd, &st)==0 && S_ISREG(st.st_mode) && st.st_size>0){
+		void *addr=mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(addr!=MAP_FAILED){
+			madvise(addr, st.st_size, MADV_SEQUENTIAL);
+			Data=static_cast<const char*>(addr);
+			Size=st.st_size;
+			IsMapped=true;
+			close(fd);
+			return true;
+		}
+	}
+
+	//mmapできないファイル(空ファイル，パイプ等)は読み込み
+	std::string contents;
+	char read_buf[4096];
+	ssize_t read_size;
+	while((read_size=read(fd, read_buf, sizeof(read_buf)))>0)
+		contents.append(read_buf, read_size);
+	close(fd);
+	if(read_size<0)
+		return false;
+
+	char *data=new char[contents.size()+1];
+	contents.copy(data, contents.size());
+	data[contents.size()]='\0';
+	Data=data;
+	Size=contents.size();
+	IsMapped=false;
+	return true;
+}
+
+
+/**
+  * バッファの一部を置き換える
+  * 置き換え後のバッファは読み込み時と同様にヒープ上に確保する
+  * @param 置き換える範囲の開始位置，終了位置，置き換える文字列
+  */
+void SourceBuffer::replace(int begin, int end, const std::string &text){
+	size_t size=Size-(end-begin)+text.size();
+	char *data=new char[size+1];
+	memcpy(data, Data, begin);
+	text.copy(data+begin, text.size());
+	memcpy(data+begin+text.size(), Data+end, Size-end);
+	data[size]='\0';
+
+	release();
+	Data=data;
+	Size=size;
+	IsMapped=false;
+}
+
+
+/**
+  * バッファの解放
+  */
+void SourceBuffer::release(){
+	if(IsMapped){
+		munmap(const_cast<char*>(Data), Size);
+	}else{
+		delete[] Data;
+	}
+	Data=NULL;
+	Size=0;
+}
+
+
+/**
+  * コンストラクタ(逐次切り出し)
+  * 直近window_size個(2のべき乗に切り上げ)のトークンのみを保持する
+  * @param SourceBuffer, 保持するトークン数
+  */
+TokenStream::TokenStream(SourceBuffer *source, int window_size)
+	:Source(source), OwnsSource(true), CurIndex(0), NumLexed(0), Error(false), NumRewinds(0), NumRewound(0){
+	//先読み(peekType)中も現在のトークンを保持するため最低2個
+	int size=2;
+	while(size<window_size)
+		size<<=1;
+	Kinds.resize(size);
+	Offsets.resize(size);
+	Lengths.resize(size);
+	Lines.resize(size);
+	Values.resize(size);
+	WindowMask=size-1;
+	Lex=new Lexer(source);
+	lexNextToken();
+}
 
 
 /**
   * デストラクタ
   */
 TokenStream::~TokenStream(){
-	for(int i=0; i<Tokens.size(); i++){
-		SAFE_DELETE(Tokens[i]);
+	SAFE_DELETE(Lex);
+	if(OwnsSource)
+		SAFE_DELETE(Source);
+}
+
+
+/**
+  * 逐次切り出し時に次のトークンを切り出してリングバッファに追加
+  * 解析不能字句の場合はEOFを追加してエラーを記録する
+  * @return 成功時：true　切り出し済みのトークンがEOFの場合：false
+  */
+bool TokenStream::lexNextToken(){
+	//エラー時は既にEOFを追加済み
+	if(Lex->hasError())
+		return false;
+
+	Token token;
+	if(!Lex->lexToken(token)){
+		if(!Lex->hasError())
+			return false;
+		Lex->printError();
+		token=Token(TOK_EOF, Source->getSize(), 0, 0);
+		Error=true;
 	}
-	Tokens.clear();
+
+	int slot=getSlot(NumLexed);
+	Kinds[slot]=token.getTokenType();
+	Offsets[slot]=token.getOffset();
+	Lengths[slot]=token.getLength();
+	Lines[slot]=token.getLine();
+	Values[slot]=token.getValue();
+	NumLexed++;
+	return true;
+}
+
+
+/**
+  * indexのトークンがリングバッファ内に残っているか確認
+  * @return 残っている場合：true　リングバッファより前の場合はエラーを記録してfalse
+  */
+bool TokenStream::checkWindow(int index){
+	if(!Lex || index>=NumLexed-(int)Kinds.size())
+		return true;
+	fprintf(stderr, "token window exceeded : cannot rewind to token %d (window size %d)\n",
+			index, (int)Kinds.size());
+	Error=true;
+	return false;
 }
 
 
@@ -166,7 +740,8 @@ TokenStream::~TokenStream(){
   * @return CureIndex番目のToken
   */
 Token TokenStream::getToken(){
-	return *Tokens[CurIndex];
+	int slot=getSlot(CurIndex);
+	return Token((TokenType)Kinds[slot], Offsets[slot], Lengths[slot], Lines[slot], Values[slot]);
 }
 
 
@@ -175,15 +750,32 @@ Token TokenStream::getToken(){
   * @return 成功時：true　失敗時：false
   */
 bool TokenStream::getNextToken(){
-	int size=Tokens.size();
-	if(--size==CurIndex){
-		return false;
-	}else if( CurIndex < size ){
+	if(CurIndex+1<NumLexed){
 		CurIndex++;
-		return true;	
-	}else{
-		return false;
+		return true;
 	}
+
+	//逐次切り出し
+	if(Lex && lexNextToken()){
+		CurIndex++;
+		return true;
+	}
+	return false;
+}
+
+
+/**
+  * 現在位置からahead個先のトークン種別を取得(インデックスは進めない)
+  * 逐次切り出し時は必要な分だけ切り出す．aheadはWindow未満であること
+  * @return ahead個先のトークン種別，末尾を越える場合は最後のトークン種別
+  */
+TokenType TokenStream::peekType(int ahead){
+	int index=CurIndex+ahead;
+	while(index>=NumLexed){
+		if(!Lex || !lexNextToken())
+			return (TokenType)Kinds[getSlot(NumLexed-1)];
+	}
+	return (TokenType)Kinds[getSlot(index)];
 }
 
 
@@ -191,28 +783,209 @@ bool TokenStream::getNextToken(){
   * インデックスをtimes回戻す
   */
 bool TokenStream::ungetToken(int times){
+	if(times>0)
+		NumRewinds++;
 	for(int i=0; i<times;i++){
-		if(CurIndex == 0)
+		if(CurIndex == 0 || !checkWindow(CurIndex-1))
 			return false;
 		else
 			CurIndex--;
+		NumRewound++;
 	}
 	return true;
 }
 
 
+/**
+  * インデックスを指定位置に戻す
+  */
+bool TokenStream::applyTokenIndex(int index){
+	if(!checkWindow(index))
+		return false;
+	if(index<CurIndex){
+		NumRewinds++;
+		NumRewound+=CurIndex-index;
+	}
+	CurIndex=index;
+	return true;
+}
+
+
+/**
+  * [begin, end)のトークンをコピーしたTokenStreamを作成(一括切り出し時のみ)
+  * 末尾にはEOFを追加する．SourceBufferは共有し，元のTokenStreamより先に解放すること
+  * 並列構文解析で関数ごとに独立した読み出し位置を持たせるために使う
+  * @param 開始インデックス，終了インデックス，
+  *        再利用するslice()の結果(確保済みの配列を使い回す．NULLの場合は新たに作成)
+  * @return 作成したTokenStream
+  */
+TokenStream *TokenStream::slice(int begin, int end, TokenStream *reuse){
+	TokenStream *tokens=reuse;
+	if(tokens){
+		tokens->Source=Source;
+		tokens->CurIndex=0;
+		tokens->Error=false;
+		tokens->NumRewinds=0;
+		tokens->NumRewound=0;
+	}else{
+		tokens=new TokenStream(Source);
+	}
+	tokens->OwnsSource=false;
+	tokens->Kinds.assign(Kinds.begin()+begin, Kinds.begin()+end);
+	tokens->Offsets.assign(Offsets.begin()+begin, Offsets.begin()+end);
+	tokens->Lengths.assign(Lengths.begin()+begin, Lengths.begin()+end);
+	tokens->Lines.assign(Lines.begin()+begin, Lines.begin()+end);
+	tokens->Values.assign(Values.begin()+begin, Values.begin()+end);
+	tokens->NumLexed=end-begin;
+	tokens->pushToken(Token(TOK_EOF, Offsets[end-1]+Lengths[end-1], 0, Lines[end-1]));
+	return tokens;
+}
+
+
 /**
   * 格納されたトークン一覧を表示する
+  * 逐次切り出し時はリングバッファ内のトークンのみ
   */
 bool TokenStream::printTokens(){
-	std::vector<Token*>::iterator titer = Tokens.begin();
-	while( titer != Tokens.end() ){
-		fprintf(stdout,"%d:", (*titer)->getTokenType());
-		if((*titer)->getTokenType()!=TOK_EOF)
-			fprintf(stdout,"%s\n", (*titer)->getTokenString().c_str());
-		++titer;
+	int begin=0;
+	if(Lex)
+		begin=std::max(0, NumLexed-(int)Kinds.size());
+	for(int i=begin; i<NumLexed; i++){
+		fprintf(stdout,"%d:", Kinds[getSlot(i)]);
+		if(Kinds[getSlot(i)]!=TOK_EOF)
+			fprintf(stdout,"%.*s\n", getTokenLength(i), getTokenText(i));
 	}
 	return true;
 }
 
 
+/**
+  * 行頭位置の一覧を作成する
+  */
+void TokenStream::buildLineTable(){
+	const char *buf=Source->getData();
+	int length=Source->getSize();
+	bool in_comment=false;
+	int index=0;
+
+	LineOffsets.assign(1, 0);
+	LineInComment.assign(1, false);
+	while((index=scanLine(buf, index, length, in_comment))<length){
+		LineOffsets.push_back(index);
+		LineInComment.push_back(in_comment);
+	}
+}
+
+
+/**
+  * 配列のfirstからlastまでをvaluesで置き換える
+  */
+template<typename T>
+static void spliceArray(std::vector<T> &array, int first, int last, const std::vector<T> &values){
+	array.erase(array.begin()+first, array.begin()+last);
+	array.insert(array.begin()+first, values.begin(), values.end());
+}
+
+
+/**
+  * 編集箇所の再字句解析
+  * ソースの[begin, end)をtextで置き換え，影響する行のみを字句解析し直して
+  * トークン列に反映する．以降のトークンはオフセットと行番号をずらす
+  * 再解析範囲は編集位置を含む行から，ブロックコメント外で始まる行まで遡り，
+  * 編集範囲以降でコメントの状態が編集前と一致する行頭までとする
+  * 解析位置は先頭に戻る．解析不能字句の場合はエラーを記録するので全体を字句解析し直すこと
+  * @param 置き換える範囲の開始位置，終了位置(編集前のオフセット)，置き換える文字列
+  * @return 成功時：true　失敗時：false
+  */
+bool TokenStream::relex(int begin, int end, const std::string &text){
+	if(Lex){
+		fprintf(stderr, "relex is not supported with token window\n");
+		return false;
+	}
+	if(Error || begin<0 || end<begin || end>(int)Source->getSize())
+		return false;
+	if(LineOffsets.empty())
+		buildLineTable();
+
+	//編集位置を含む行から，ブロックコメント外で始まる行まで遡る
+	int start_line=std::upper_bound(LineOffsets.begin(), LineOffsets.end(), begin)-LineOffsets.begin()-1;
+	while(LineInComment[start_line])
+		start_line--;
+	int relex_begin=LineOffsets[start_line];
+
+	int old_size=Source->getSize();
+	int delta=(int)text.size()-(end-begin);
+	Source->replace(begin, end, text);
+	const char *buf=Source->getData();
+	int new_size=Source->getSize();
+
+	//編集範囲以降でコメントの状態が編集前と一致する行頭を探す
+	//(見つからない場合は末尾まで)
+	int edit_end=begin+text.size();
+	int end_line=LineOffsets.size();
+	std::vector<int> new_offsets;
+	std::vector<unsigned char> new_in_comment;
+	bool in_comment=false;
+	int index=relex_begin;
+	while((index=scanLine(buf, index, new_size, in_comment))<new_size){
+		if(index>edit_end){
+			std::vector<int>::iterator it=std::lower_bound(
+					LineOffsets.begin()+start_line, LineOffsets.end(), index-delta);
+			if(it!=LineOffsets.end() && *it==index-delta &&
+					LineInComment[it-LineOffsets.begin()]==in_comment){
+				end_line=it-LineOffsets.begin();
+				break;
+			}
+		}
+		new_offsets.push_back(index);
+		new_in_comment.push_back(in_comment);
+	}
+	bool to_eof=(end_line==(int)LineOffsets.size());
+	int old_relex_end=to_eof ? old_size : LineOffsets[end_line];
+	int relex_end=to_eof ? new_size : old_relex_end+delta;
+
+	//再字句解析
+	Lexer lexer(Source, relex_begin, relex_end, start_line, &getInterner());
+	std::vector<unsigned char> kinds;
+	std::vector<int> offsets, lengths, lines, values;
+	Token token;
+	while(lexer.lexToken(token)){
+		if(token.getTokenType()==TOK_EOF && !to_eof)
+			break;
+		kinds.push_back(token.getTokenType());
+		offsets.push_back(token.getOffset());
+		lengths.push_back(token.getLength());
+		lines.push_back(token.getLine());
+		values.push_back(token.getValue());
+	}
+	if(lexer.hasError()){
+		lexer.printError();
+		Error=true;
+		return false;
+	}
+
+	//置き換え範囲より後のトークンをずらす
+	int first=std::lower_bound(Offsets.begin(), Offsets.end(), relex_begin)-Offsets.begin();
+	int last=to_eof ? NumLexed :
+		std::lower_bound(Offsets.begin(), Offsets.end(), old_relex_end)-Offsets.begin();
+	int line_delta=(int)new_offsets.size()-(end_line-start_line-1);
+	for(int i=last; i<NumLexed; i++){
+		Offsets[i]+=delta;
+		Lines[i]+=line_delta;
+	}
+	spliceArray(Kinds, first, last, kinds);
+	spliceArray(Offsets, first, last, offsets);
+	spliceArray(Lengths, first, last, lengths);
+	spliceArray(Lines, first, last, lines);
+	spliceArray(Values, first, last, values);
+	NumLexed=Kinds.size();
+
+	//行頭位置の更新
+	for(int i=end_line; i<(int)LineOffsets.size(); i++)
+		LineOffsets[i]+=delta;
+	spliceArray(LineOffsets, start_line+1, end_line, new_offsets);
+	spliceArray(LineInComment, start_line+1, end_line, new_in_comment);
+
+	CurIndex=0;
+	return true;
+}
@@ -1,12 +1,32 @@
 #include "parser.hpp"
+#include<pthread.h>
 
 
 
 /**
   * コンストラクタ
+  * @param 入力ファイル名，逐次字句解析時に保持するトークン数(0の場合は一括で字句解析)，字句解析・構文解析のスレッド数
   */
-Parser::Parser(std::string filename){
-	Tokens=LexicalAnalysis(filename);
+Parser::Parser(std::string filename, int token_window, int num_threads){
+	Tokens=LexicalAnalysis(filename, token_window, num_threads);
+	TU=NULL;
+	Arena=NULL;
+	Threads=num_threads;
+	VisibleLimit=INT_MAX;
+}
+
+
+/**
+  * コンストラクタ(字句解析済み)
+  * TokenStreamはParserが所有する
+  * @param 字句解析済みのTokenStream，構文解析のスレッド数
+  */
+Parser::Parser(TokenStream *tokens, int num_threads){
+	Tokens=tokens;
+	TU=NULL;
+	Arena=NULL;
+	Threads=num_threads;
+	VisibleLimit=INT_MAX;
 }
 
 
@@ -18,8 +38,16 @@ bool Parser::doParse(){
 	if(!Tokens){
 		fprintf(stderr, "error at lexer\n");
 		return false;
-	}else
-		return visitTranslationUnit();
+	}
+
+	bool result=visitTranslationUnit();
+
+	//逐次字句解析中のエラー(解析不能字句，Window外への巻き戻し)
+	if(Tokens->hasError()){
+		fprintf(stderr, "error at token stream\n");
+		return false;
+	}
+	return result;
 }
 
 
@@ -42,10 +70,21 @@ TranslationUnitAST &Parser::getAST(){
 bool Parser::visitTranslationUnit(){
 	//最初にprintnumの宣言追加
 	TU=new TranslationUnitAST();
-	std::vector<std::string> param_list;
-	param_list.push_back("i");
-	TU->addPrototype(new PrototypeAST("printnum", param_list));
-	PrototypeTable["printnum"]=1;
+	Arena=&TU->getArena();
+	std::vector<SymbolID> param_list;
+	param_list.push_back(internSymbol("i"));
+	SymbolID printnum=internSymbol("printnum");
+	TU->addPrototype(new(*Arena) PrototypeAST(*Arena, printnum, param_list));
+	Symbols.declare(printnum, SYMBOL_PROTOTYPE, 1);
+
+	//関数本文の並列構文解析(一括字句解析時のみ)
+	if(Threads>1 && !Tokens->isLazy()){
+		if(!visitTranslationUnitParallel()){
+			SAFE_DELETE(TU);
+			return false;
+		}
+		return true;
+	}
 
 	//ExternalDecl
 	while(true){
@@ -53,31 +92,188 @@ bool Parser::visitTranslationUnit(){
 			SAFE_DELETE(TU);
 			return false;
 		}
-		if(Tokens->getCurType()==TOK_EOF)
+		if(Tokens->getCurType()==TOK_EOF || Tokens->hasError())
 			break;
 	}
 	return true;
 }
 
 
+/**
+  * 並列構文解析の1スレッド分
+  */
+struct ParseChunk{
+	Parser *Worker;			//スレッドごとの構文解析器(識別子表は複製)
+	TokenStream *Tokens;	//翻訳単位全体のTokenStream(読み出しのみ)
+	std::vector<FunctionItem> *Items;
+	int Begin;
+	int End;
+	bool Result;
+};
+
+
+/**
+  * TranslationUnit用構文解析メソッド(並列)
+  * 逐次の前処理でPrototypeと宣言を解析し，関数本文は'{'と'}'の対応だけを辿って範囲を記録する．
+  * 関数本文は複数スレッドで解析し，FunctionASTをソースの順にTranslationUnitに追加する
+  * @return 解析成功：true　解析失敗：false
+  */
+bool Parser::visitTranslationUnitParallel(){
+	std::vector<FunctionItem> items;
+	bool result=true;
+
+	//Prototypeと引数の数を先に全て集める
+	while(result){
+		PrototypeAST *proto=visitPrototype();
+		if(!proto){
+			result=false;
+			break;
+		}
+
+		//FunctionDeclaration
+		if(Tokens->getCurType()==TOK_SEMICOLON){
+			if(visitFunctionDeclaration(proto))
+				TU->addPrototype(proto);
+			else
+				result=false;
+
+		//FunctionDefinition
+		}else if(!checkFunctionDefinition(proto)){
+			result=false;
+		}else{
+			FunctionItem item;
+			item.Proto=proto;
+			item.Begin=Tokens->getCurIndex();
+			item.End=skipFunctionStatement();
+			item.Visible=Symbols.size();
+			item.Func=NULL;
+			items.push_back(item);
+			if(item.End<0)
+				result=false;
+			else
+				declareFunction(proto);
+		}
+
+		if(Tokens->getCurType()==TOK_EOF || Tokens->hasError())
+			break;
+	}
+
+	//関数本文をトークン数がほぼ均等になるようにスレッドへ割り当てる
+	int num_threads=std::min<int>(Threads, items.size());
+	std::vector<ParseChunk> chunks;
+	if(result && num_threads>0){
+		long long total=0;
+		for(int i=0; i<items.size(); i++)
+			total+=items[i].End-items[i].Begin;
+		long long sum=0;
+		for(int i=0; i<items.size(); i++){
+			if(chunks.empty() || sum>=total*chunks.size()/num_threads){
+				ParseChunk chunk;
+				chunk.Worker=new Parser((TokenStream*)NULL);
+				chunk.Worker->Symbols=Symbols;
+				chunk.Worker->Arena=new ASTArena();
+				chunk.Tokens=Tokens;
+				chunk.Items=&items;
+				chunk.Begin=i;
+				chunk.Result=true;
+				chunks.push_back(chunk);
+			}
+			chunks.back().End=i+1;
+			sum+=items[i].End-items[i].Begin;
+		}
+	}
+
+	//先頭チャンクは呼び出し元スレッドで処理
+	int num_chunks=chunks.size();
+	std::vector<pthread_t> threads(num_chunks);
+	std::vector<bool> started(num_chunks, false);
+	for(int i=1; i<num_chunks; i++)
+		started[i]=(pthread_create(&threads[i], NULL, parseFunctionChunk, &chunks[i])==0);
+	if(num_chunks>0)
+		parseFunctionChunk(&chunks[0]);
+	for(int i=1; i<num_chunks; i++){
+		if(started[i])
+			pthread_join(threads[i], NULL);
+		else
+			parseFunctionChunk(&chunks[i]);
+	}
+	for(int i=0; i<num_chunks; i++){
+		result=result && chunks[i].Result;
+		Arena->merge(*chunks[i].Worker->Arena);
+		SAFE_DELETE(chunks[i].Worker->Arena);
+		SAFE_DELETE(chunks[i].Worker);
+	}
+
+	//ソースの順に追加
+	if(result){
+		for(int i=0; i<items.size(); i++)
+			TU->addFunction(items[i].Func);
+	}
+	return result;
+}
+
+
+/**
+  * 並列構文解析のスレッド関数
+  * 割り当てられた関数本文を順に解析する
+  */
+void *Parser::parseFunctionChunk(void *arg){
+	ParseChunk *chunk=static_cast<ParseChunk*>(arg);
+	for(int i=chunk->Begin; i<chunk->End && chunk->Result; i++){
+		FunctionItem &item=(*chunk->Items)[i];
+		item.Func=chunk->Worker->visitFunctionItem(item, chunk->Tokens);
+		if(!item.Func)
+			chunk->Result=false;
+	}
+	return NULL;
+}
+
+
+/**
+  * 並列構文解析時の関数本文の構文解析メソッド
+  * 関数本文の範囲だけを複製したTokenStream(スレッドごとに使い回す)を解析する
+  * @param 関数本文の範囲，翻訳単位全体のTokenStream
+  * @return 解析成功：FunctionAST　解析失敗：NULL
+  */
+FunctionAST *Parser::visitFunctionItem(FunctionItem &item, TokenStream *tokens){
+	Tokens=tokens->slice(item.Begin, item.End, Tokens);
+	VisibleLimit=item.Visible;
+
+	Symbols.pushScope();
+	FunctionStmtAST *func_stmt=visitFunctionStatement(item.Proto);
+	Symbols.popScope();
+
+	bool at_end=(Tokens->getCurType()==TOK_EOF);
+	if(!func_stmt || !at_end)
+		return NULL;
+	return new(*Arena) FunctionAST(item.Proto, func_stmt);
+}
+
+
 /**
   * ExternalDeclaration用構文解析クラス
+  * Prototypeを一度だけ解析し，後続のトークンで宣言か定義かを決定する
   * 解析したPrototyupeとFunctionASTをTranslationUitに追加
   * @param TranslationUnitAST
-  * @return true 
+  * @return 解析成功：true　解析失敗：false
   */
 bool Parser::visitExternalDeclaration(
 		TranslationUnitAST *tunit
 		){
+	PrototypeAST *proto=visitPrototype();
+	if(!proto)
+		return false;
+
 	//FunctionDeclaration
-	PrototypeAST *proto=visitFunctionDeclaration();
-	if(proto){
+	if(Tokens->getCurType()==TOK_SEMICOLON){
+		if(!visitFunctionDeclaration(proto))
+			return false;
 		tunit->addPrototype(proto);
 		return true;
 	}
 
 	//FunctionDefinition
-	FunctionAST *func_def=visitFunctionDefinition();
+	FunctionAST *func_def=visitFunctionDefinition(proto);
 	if(func_def){
 		tunit->addFunction(func_def);
 		return true;
@@ -89,76 +285,119 @@ bool Parser::visitExternalDeclaration(
 
 /**
   * FunctionDclaration用構文解析メソッド
+  * @param 解析済みのPrototypeAST
   * @return 解析成功：PrototypeAST　解析失敗：NULL
   */
-PrototypeAST *Parser::visitFunctionDeclaration(){
-	int bkup=Tokens->getCurIndex();
-	PrototypeAST *proto=visitPrototype();
-	if(!proto){
-		return NULL;
-	}
-
+PrototypeAST *Parser::visitFunctionDeclaration(PrototypeAST *proto){
 	//prototype;
-	if(Tokens->getCurString()==";"){
-		if( PrototypeTable.find(proto->getName()) != PrototypeTable.end() ||
-			(FunctionTable.find(proto->getName()) != FunctionTable.end() &&
-			FunctionTable[proto->getName()] != proto->getParamNum() ) ){
-			fprintf(stderr, "Function：%s is redefined" ,proto->getName().c_str()); 
-			SAFE_DELETE(proto);
-			return NULL;
-		}
-		PrototypeTable[proto->getName()]=proto->getParamNum();
-		Tokens->getNextToken();
-		return proto;
-	}else{
-		SAFE_DELETE(proto);
-		Tokens->applyTokenIndex(bkup);
+	ScopedSymbol *sym=Symbols.lookup(proto->getSymbol());
+	if(sym && ((sym->Flags & SYMBOL_PROTOTYPE) || sym->Arity != proto->getParamNum())){
+		fprintf(stderr, "Function：%s is redefined" ,proto->getName().c_str()); 
 		return NULL;
 	}
-	
+	if(sym)
+		sym->Flags|=SYMBOL_PROTOTYPE;
+	else
+		Symbols.declare(proto->getSymbol(), SYMBOL_PROTOTYPE, proto->getParamNum());
+	Tokens->getNextToken();
+	return proto;
 }
 
 
 /**
   * FunctionDfinition用構文解析メソッド
+  * @param 解析済みのPrototypeAST
   * @return 解析成功：FunctionAST　解析失敗：NULL
   */
-FunctionAST *Parser::visitFunctionDefinition(){
-	int bkup=Tokens->getCurIndex();
-
-	PrototypeAST *proto=visitPrototype();
-	if(!proto){
+FunctionAST *Parser::visitFunctionDefinition(PrototypeAST *proto){
+	if(!checkFunctionDefinition(proto))
 		return NULL;
-	}else if( (PrototypeTable.find(proto->getName()) != PrototypeTable.end() &&
-				PrototypeTable[proto->getName()] != proto->getParamNum() ) ||
-				FunctionTable.find(proto->getName()) != FunctionTable.end()){
-			fprintf(stderr, "Function：%s is redefined" ,proto->getName().c_str()); 
-			SAFE_DELETE(proto);
-			return NULL;
-	}
 
-	VariableTable.clear();
+	//引数とローカル変数は関数のスコープに登録
+	Symbols.pushScope();
 	FunctionStmtAST *func_stmt = visitFunctionStatement(proto);
+	Symbols.popScope();
 	if(func_stmt){
-		FunctionTable[proto->getName()]=proto->getParamNum();
-		return new FunctionAST(proto,func_stmt);
+		declareFunction(proto);
+		return new(*Arena) FunctionAST(proto,func_stmt);
 	}else{
-		SAFE_DELETE(proto);
-		Tokens->applyTokenIndex(bkup);
 		return NULL;
 	}
 }
 
 
+/**
+  * 関数定義の重複確認
+  * @param 解析済みのPrototypeAST
+  * @return 定義可能：true　定義済み，または宣言と引数の数が異なる：false
+  */
+bool Parser::checkFunctionDefinition(PrototypeAST *proto){
+	ScopedSymbol *sym=Symbols.lookup(proto->getSymbol());
+	if(sym && ((sym->Flags & SYMBOL_FUNCTION) || sym->Arity != proto->getParamNum())){
+		fprintf(stderr, "Function：%s is redefined" ,proto->getName().c_str()); 
+		return false;
+	}
+	return true;
+}
+
+
+/**
+  * 関数定義を識別子表に登録
+  * 宣言済みの場合は宣言のエントリに定義済みの印を付ける
+  * @param 解析済みのPrototypeAST
+  */
+void Parser::declareFunction(PrototypeAST *proto){
+	ScopedSymbol *sym=Symbols.lookup(proto->getSymbol());
+	if(sym)
+		sym->Flags|=SYMBOL_FUNCTION;
+	else
+		Symbols.declare(proto->getSymbol(), SYMBOL_FUNCTION, proto->getParamNum());
+}
+
+
+/**
+  * function_statementの読み飛ばし
+  * '{'と'}'の対応だけを辿り，本文は解析しない
+  * @return 成功時：'}'の次のインデックス　失敗時：-1
+  */
+int Parser::skipFunctionStatement(){
+	if(Tokens->getCurType()!=TOK_LBRACE)
+		return -1;
+
+	int depth=0;
+	do{
+		if(Tokens->getCurType()==TOK_LBRACE)
+			depth++;
+		else if(Tokens->getCurType()==TOK_RBRACE)
+			depth--;
+		else if(Tokens->getCurType()==TOK_EOF)
+			return -1;
+		Tokens->getNextToken();
+	}while(depth>0);
+	return Tokens->getCurIndex();
+}
+
+
+/**
+  * 識別子表の参照
+  * 並列構文解析時は，解析中の関数より後で宣言・定義される関数を参照しない
+  * @param シンボルID
+  * @return 最も内側のエントリ，参照できない場合はNULL
+  */
+ScopedSymbol *Parser::lookupSymbol(SymbolID id){
+	ScopedSymbol *sym=Symbols.lookup(id);
+	if(sym && sym->Depth==0 && Symbols.getIndex(sym)>=VisibleLimit)
+		return NULL;
+	return sym;
+}
+
+
 /**
   * Prototype用構文解析メソッド
   * @return 解析成功：PrototypeAST　解析失敗：NULL
   */
 PrototypeAST *Parser	::visitPrototype(){
-	std::string func_name;
-
-	//bkup index
-	int bkup=Tokens->getCurIndex();
+	SymbolID func_name;
 
 	//type_specifier
 	if(Tokens->getCurType()==TOK_INT){
@@ -167,62 +406,63 @@ PrototypeAST *Parser	::visitPrototype(){
 		return NULL;
 	}
 
-
 	//IDENTIFIER
 	if(Tokens->getCurType()==TOK_IDENTIFIER){
-		func_name=Tokens->getCurString();
+		func_name=Tokens->getCurSymbol();
 		Tokens->getNextToken();
 	}else{
-		Tokens->ungetToken(1);	//unget TOK_INT
 		return NULL;
 	}
 
 	//'('
-	if(Tokens->getCurString()=="("){
+	if(Tokens->getCurType()==TOK_LPAREN){
 		Tokens->getNextToken();
 	}else{
-		Tokens->ungetToken(2);	//unget TOK_INT IDENTIFIER
 		return NULL;
 	}
 
 
-	//parameter_list
-	std::vector<std::string> param_list;
-	bool is_first_param = true;
-	while(true){
-		//','
-		if(!is_first_param && Tokens->getCurType()==TOK_SYMBOL && Tokens->getCurString()==","){
-			Tokens->getNextToken();
-		}
-		if(Tokens->getCurType()==TOK_INT){
-			Tokens->getNextToken();
-		}else{
-			break;
-		}
+	//parameter_list(ParamStackのbegin以降に積む)
+	int begin=ParamStack.size();
+	if(Tokens->getCurType()==TOK_INT){
+		while(true){
+			//INT
+			if(Tokens->getCurType()==TOK_INT){
+				Tokens->getNextToken();
+			}else{
+				return NULL;
+			}
 
-		if(Tokens->getCurType()==TOK_IDENTIFIER){
-			//引数の変数名に被りがないか確認
-			if(std::find(param_list.begin(), param_list.end(), Tokens->getCurString()) !=
-					param_list.end()){
-				Tokens->applyTokenIndex(bkup);
+			//IDENTIFIER
+			if(Tokens->getCurType()==TOK_IDENTIFIER){
+				//引数の変数名に被りがないか確認
+				if(std::find(ParamStack.begin()+begin, ParamStack.end(), Tokens->getCurSymbol()) !=
+						ParamStack.end()){
+					return NULL;
+				}
+				ParamStack.push_back(Tokens->getCurSymbol());
+				Tokens->getNextToken();
+			}else{
 				return NULL;
 			}
-			param_list.push_back(Tokens->getCurString());
-			Tokens->getNextToken();
-		}else{
-			Tokens->applyTokenIndex(bkup);
-			return NULL;
+
+			//','
+			if(Tokens->getCurType()==TOK_COMMA){
+				Tokens->getNextToken();
+			}else{
+				break;
+			}
 		}
-		is_first_param = false;
 	}
 	
 
 	//')'
-	if(Tokens->getCurString()==")"){
+	if(Tokens->getCurType()==TOK_RPAREN){
 		Tokens->getNextToken();
-		return new PrototypeAST(func_name, param_list);
+		PrototypeAST *proto=new(*Arena) PrototypeAST(*Arena, func_name, ParamStack, begin);
+		ParamStack.resize(begin);
+		return proto;
 	}else{
-		Tokens->applyTokenIndex(bkup);
 		return NULL;
 	}
 }
@@ -234,86 +474,53 @@ PrototypeAST *Parser	::visitPrototype(){
   * @return 解析成功：FunctionSmtAST　解析失敗：NULL
   */
 FunctionStmtAST *Parser::visitFunctionStatement(PrototypeAST *proto){
-	int bkup=Tokens->getCurIndex();
-
 	//{
-	if(Tokens->getCurString()=="{"){
+	if(Tokens->getCurType()==TOK_LBRACE){
 		Tokens->getNextToken();
 	}else{
 		return NULL;
 	}
 
-	//create FunctionStatement
-	FunctionStmtAST *func_stmt = new FunctionStmtAST();
+	//FunctionStatementの要素(DeclStack，NodeStackに積み，解析後にアリーナへまとめて配置)
+	int decl_begin=DeclStack.size();
+	int stmt_begin=NodeStack.size();
 
 	//add parameter to FunctionStatement
 	for(int i=0; i<proto->getParamNum(); i++){
-		VariableDeclAST *vdecl=new VariableDeclAST(proto->getParamName(i));
+		VariableDeclAST *vdecl=new(*Arena) VariableDeclAST(proto->getParamSymbol(i));
 		vdecl->setDeclType(VariableDeclAST::param);
-		func_stmt->addVariableDeclaration(vdecl);
-		VariableTable.push_back(vdecl->getName());
+		DeclStack.push_back(vdecl);
+		Symbols.declare(vdecl->getSymbol(), SYMBOL_VARIABLE);
 	}
 
-	VariableDeclAST *var_decl;
-	BaseAST *stmt;
-	BaseAST *last_stmt;
-
-	//{statement_list}
-	if(stmt=visitStatement()){
-		while(stmt){
-			last_stmt=stmt;
-			func_stmt->addStatement(stmt);
-			stmt=visitStatement();
-		}
-
-	//variable_declaration_list
-	}else if(var_decl=visitVariableDeclaration()){
-		while(var_decl){
-			var_decl->setDeclType(VariableDeclAST::local);
-			if(std::find(VariableTable.begin(), VariableTable.end(), var_decl->getName()) !=
-					VariableTable.end()){
-				SAFE_DELETE(var_decl);
-				SAFE_DELETE(func_stmt);
-				return NULL;
-			}
-			func_stmt->addVariableDeclaration(var_decl);
-			VariableTable.push_back(var_decl->getName());
-			//parse Variable Delaration
-			var_decl=visitVariableDeclaration();
-		}
-
-		if(stmt=visitStatement()){
-			while(stmt){
-				last_stmt=stmt;
-				func_stmt->addStatement(stmt);
-				stmt=visitStatement();
-			}
-		}
+	//variable_declaration_list(INTで始まる)
+	while(Tokens->getCurType()==TOK_INT){
+		VariableDeclAST *var_decl=visitVariableDeclaration();
+		if(!var_decl || !Symbols.declare(var_decl->getSymbol(), SYMBOL_VARIABLE))
+			return NULL;
+		var_decl->setDeclType(VariableDeclAST::local);
+		DeclStack.push_back(var_decl);
+	}
 
-	//other
-	}else{
-		SAFE_DELETE(func_stmt);
-		Tokens->applyTokenIndex(bkup);
-		return NULL;
+	//statement_list('}'まで)
+	while(Tokens->getCurType()!=TOK_RBRACE){
+		BaseAST *stmt=visitStatement();
+		if(!stmt)
+			return NULL;
+		NodeStack.push_back(stmt);
 	}
 
 	//check if last statement is jump_statement
-	if(!last_stmt || !llvm::isa<JumpStmtAST>(last_stmt)){
-		SAFE_DELETE(func_stmt);
-		Tokens->applyTokenIndex(bkup);
+	if(NodeStack.size()==stmt_begin || !llvm::isa<JumpStmtAST>(NodeStack.back()))
 		return NULL;
-	}
 
 	//}
-	if(Tokens->getCurString()=="}"){
-		Tokens->getNextToken();
-		return func_stmt;
-	}else{
-		SAFE_DELETE(func_stmt);
-		Tokens->applyTokenIndex(bkup);
-		return NULL;
-	}
-
+	Tokens->getNextToken();
+	FunctionStmtAST *func_stmt=new(*Arena) FunctionStmtAST(*Arena, DeclStack, decl_begin,
+			NodeStack, stmt_begin);
+	DeclStack.resize(decl_begin);
+	NodeStack.resize(stmt_begin);
+	return func_stmt;
 }
 
 
@@ -322,7 +529,7 @@ FunctionStmtAST *Parser::visitFunctionStatement(PrototypeAST *proto){
   * @return 解析成功：VariableDeclAST　解析失敗：NULL
   */
 VariableDeclAST *Parser::visitVariableDeclaration(){
-	std::string name;
+	SymbolID name;
 
 	//INT
 	if(Tokens->getCurType()==TOK_INT){
@@ -333,19 +540,17 @@ VariableDeclAST *Parser::visitVariableDeclaration(){
 	
 	//IDENTIFIER
 	if(Tokens->getCurType()==TOK_IDENTIFIER){
-		name=Tokens->getCurString();
+		name=Tokens->getCurSymbol();
 		Tokens->getNextToken();
 	}else{
-		Tokens->ungetToken(1);
 		return NULL;
 	}
 	
 	//';'
-	if(Tokens->getCurString()==";"){
+	if(Tokens->getCurType()==TOK_SEMICOLON){
 		Tokens->getNextToken();
-		return new VariableDeclAST(name);
+		return new(*Arena) VariableDeclAST(name);
 	}else{
-		Tokens->ungetToken(2);	
 		return NULL;
 	}
 }
@@ -356,14 +561,10 @@ VariableDeclAST *Parser::visitVariableDeclaration(){
   * @return 解析成功：AST　解析失敗：NULL
   */
 BaseAST *Parser::visitStatement(){
-	BaseAST *stmt=NULL;
-	if(stmt=visitExpressionStatement()){
-		return stmt;
-	}else if(stmt=visitJumpStatement()){
-		return stmt;
-	}else{
-		return NULL;
-	}
+	if(Tokens->getCurType()==TOK_RETURN)
+		return visitJumpStatement();
+	else
+		return visitExpressionStatement();
 }
 
 
@@ -375,11 +576,11 @@ BaseAST *Parser::visitExpressionStatement(){
 	BaseAST *assign_expr;
 
 	//NULL Expression
-	if(Tokens->getCurString()==";"){
+	if(Tokens->getCurType()==TOK_SEMICOLON){
 		Tokens->getNextToken();
-		return new NullExprAST();
+		return new(*Arena) NullExprAST();
 	}else if((assign_expr=visitAssignmentExpression())){
-		if(Tokens->getCurString()==";"){
+		if(Tokens->getCurType()==TOK_SEMICOLON){
 			Tokens->getNextToken();
 			return assign_expr;
 		}
@@ -393,22 +594,18 @@ BaseAST *Parser::visitExpressionStatement(){
   * @return 解析成功：AST　解析失敗：NULL
   */
 BaseAST *Parser::visitJumpStatement(){
-	//bakup index
-	int bkup=Tokens->getCurIndex();
 	BaseAST *expr;
 
 	if(Tokens->getCurType() == TOK_RETURN){
 		Tokens->getNextToken();	
 		if(!(expr=visitAssignmentExpression()) ){
-			Tokens->applyTokenIndex(bkup);
 			return NULL;
 		}
 
-		if(Tokens->getCurString()==";"){
+		if(Tokens->getCurType()==TOK_SEMICOLON){
 			Tokens->getNextToken();
-			return new JumpStmtAST(expr);
+			return new(*Arena) JumpStmtAST(expr);
 		}else{
-			Tokens->applyTokenIndex(bkup);
 			return NULL;
 		}
 	}else{
@@ -419,230 +616,153 @@ BaseAST *Parser::visitJumpStatement(){
 
 /**
   * AssignmentExpression用構文解析メソッド
+  * IDENTIFIERの次が'='かどうか(2トークン先読み)で代入式か判断する
   * @return 解析成功：AST　解析失敗：NULL
   */
 BaseAST *Parser::visitAssignmentExpression(){
-	int bkup=Tokens->getCurIndex();
-
 	//	| IDENTIFIER '=' additive_expression
-	BaseAST *lhs;
-	if(Tokens->getCurType()==TOK_IDENTIFIER){
+	if(Tokens->getCurType()==TOK_IDENTIFIER && Tokens->peekType()==TOK_ASSIGN){
 		//変数が宣言されているか確認
-		if(std::find(VariableTable.begin(), VariableTable.end(), Tokens->getCurString()) !=
-				VariableTable.end()){
+		ScopedSymbol *sym=lookupSymbol(Tokens->getCurSymbol());
+		if(!sym || !(sym->Flags & SYMBOL_VARIABLE)){
+			return NULL;
+		}
 
-			lhs=new VariableAST(Tokens->getCurString());
-			Tokens->getNextToken();
-			BaseAST *rhs;
-			if(Tokens->getCurType()==TOK_SYMBOL &&
-				Tokens->getCurString()=="="){
-				Tokens->getNextToken();
-				if(rhs=visitAdditiveExpression(NULL)){
-					return new BinaryExprAST("=", lhs, rhs);
-				}else{
-					SAFE_DELETE(lhs);
-					Tokens->applyTokenIndex(bkup);
-				}
-			}else{
-				SAFE_DELETE(lhs);
-				Tokens->applyTokenIndex(bkup);
-			}
+		BaseAST *lhs=new(*Arena) VariableAST(Tokens->getCurSymbol());
+		Tokens->getNextToken();	//IDENTIFIER
+		Tokens->getNextToken();	//'='
+		BaseAST *rhs;
+		if(rhs=visitBinaryExpression(1)){
+			return new(*Arena) BinaryExprAST(AssignOp, lhs, rhs);
 		}else{
-			Tokens->applyTokenIndex(bkup);
+			return NULL;
 		}
 	}
 
 	//additive_expression
-	BaseAST *add_expr=visitAdditiveExpression(NULL);
-	if(add_expr){
-		return add_expr;
-	}
-
-	return NULL;
+	return visitBinaryExpression(1);
 }
 
 
 
 /**
-  * AdditiveExpression用構文解析メソッド
-  * @param lhs(左辺),初回呼び出し時はNULL
-  * @return 解析成功：AST　解析失敗：NULL
+  * 二項演算子の優先順位表
+  * 値が大きいほど強く結合する．演算子の追加はこの表に行を足すだけで良い
   */
-BaseAST *Parser::visitAdditiveExpression(BaseAST *lhs){
-	//bkup index
-	int bkup=Tokens->getCurIndex();
+static const struct{
+	TokenType Type;
+	int Precedence;
+	BinaryOp Op;
+}BinaryOpTable[]={
+	{TOK_PLUS,	1, AddOp},
+	{TOK_MINUS,	1, SubOp},
+	{TOK_STAR,	2, MulOp},
+	{TOK_SLASH,	2, DivOp},
+};
 
-	if(!lhs)
-		lhs=visitMultiplicativeExpression(NULL);
-	BaseAST *rhs;
 
-	if(!lhs){
-		return NULL;
-	}
-	//+
-	if(Tokens->getCurType()==TOK_SYMBOL &&
-				Tokens->getCurString()=="+"){
-		Tokens->getNextToken();
-		rhs=visitMultiplicativeExpression(NULL);
-		if(rhs){
-			return visitAdditiveExpression(
-						new BinaryExprAST("+", lhs, rhs)
-					);
-		}else{
-			SAFE_DELETE(lhs);
-			Tokens->applyTokenIndex(bkup);
-			return NULL;
-		}
-			
-	//-
-	}else if(Tokens->getCurType()==TOK_SYMBOL &&
-				Tokens->getCurString()=="-"){
-		Tokens->getNextToken();
-		rhs=visitMultiplicativeExpression(NULL);
-		if(rhs){
-			return visitAdditiveExpression(
-						new BinaryExprAST("-", lhs, rhs)
-					);
-		}else{
-			SAFE_DELETE(lhs);
-			Tokens->applyTokenIndex(bkup);
-			return NULL;
-		}	
-	}	
-	return lhs;
+/**
+  * 二項演算子の優先順位表引き
+  * @param トークン種別
+  * @return 優先順位表の添字，二項演算子でない場合は-1
+  */
+static int findBinaryOp(TokenType type){
+	for(int i=0; i<sizeof(BinaryOpTable)/sizeof(BinaryOpTable[0]); i++)
+		if(BinaryOpTable[i].Type==type)
+			return i;
+	return -1;
 }
 
 
 /**
-  * MultiplicativeExpression用解析メソッド
-  * @param  lhs(左辺),初回呼び出し時はNULL
+  * BinaryExpression(additive_expression，multiplicative_expression)用構文解析メソッド
+  * 優先順位法(precedence climbing)で左結合の二項演算を反復的に解析する
+  * 再帰の深さは優先順位の段数で抑えられ，式の長さには依存しない
+  * @param 解析対象とする演算子の最小優先順位(additive_expressionは1)
   * @return 解析成功：AST　解析失敗：NULL
   */
-BaseAST *Parser::visitMultiplicativeExpression(BaseAST *lhs){
-	//bkup index
-	int bkup=Tokens->getCurIndex();
-
-	//BaseAST *lhs=visitPostfixExpression();
+BaseAST *Parser::visitBinaryExpression(int min_prec){
+	BaseAST *lhs=visitPostfixExpression();
 	if(!lhs)
-		lhs=visitPostfixExpression();
-	BaseAST *rhs;
+		return NULL;
 
-	if(!lhs){
-			return NULL;
-	}
-	// *
-	if(Tokens->getCurType()==TOK_SYMBOL &&
-				Tokens->getCurString()=="*"){
-		Tokens->getNextToken();
-		rhs=visitPostfixExpression();
-		if(rhs){
-			return visitMultiplicativeExpression(
-						new BinaryExprAST("*", lhs, rhs)
-					);
-		}else{
-			SAFE_DELETE(lhs);
-			Tokens->applyTokenIndex(bkup);
-			return NULL;
-		}
-			
-	// /
-	}else if(Tokens->getCurType()==TOK_SYMBOL &&
-				Tokens->getCurString()=="/"){
+	while(true){
+		int op=findBinaryOp(Tokens->getCurType());
+		if(op<0 || BinaryOpTable[op].Precedence<min_prec)
+			return lhs;
 		Tokens->getNextToken();
-		rhs=visitPostfixExpression();
-		if(rhs){
-			return visitMultiplicativeExpression(
-						new BinaryExprAST("/", lhs, rhs)
-					);
-		}else{
-			SAFE_DELETE(lhs);
-			Tokens->applyTokenIndex(bkup);
+
+		//自分より強く結合する演算子を右辺にまとめる
+		BaseAST *rhs=visitBinaryExpression(BinaryOpTable[op].Precedence+1);
+		if(!rhs)
 			return NULL;
-		}	
-	}	
-	return lhs;
+		lhs=new(*Arena) BinaryExprAST(BinaryOpTable[op].Op, lhs, rhs);
+	}
 }
 
 
 /**
   * PostfixExpression用構文解析メソッド
+  * IDENTIFIERは識別子表を1回引き，変数か関数呼び出しかを判断する
   * @return 解析成功：AST　解析失敗：NULL
   */
 BaseAST *Parser::visitPostfixExpression(){
-	//get index
-	int bkup=Tokens->getCurIndex();
-
-	//primary_expression
-	BaseAST *prim_expr=visitPrimaryExpression();
-	if(prim_expr){
-		return prim_expr;
+	//primary_expression(IDENTIFIER以外)
+	if(Tokens->getCurType()!=TOK_IDENTIFIER){
+		return visitPrimaryExpression();
 	}
 
-	//FUNCTION_IDENTIFIER
-	if(Tokens->getCurType()==TOK_IDENTIFIER){
-		//is FUNCTION_IDENTIFIER
-		int param_num;
-		if(PrototypeTable.find(Tokens->getCurString()) !=
-			PrototypeTable.end() ){
-			param_num=PrototypeTable[Tokens->getCurString()];
-		}else if(FunctionTable.find(Tokens->getCurString()) !=
-			FunctionTable.end()){
-			param_num=FunctionTable[Tokens->getCurString()];
-		}else{
-			return NULL;
-		}
+	ScopedSymbol *sym=lookupSymbol(Tokens->getCurSymbol());
+	if(!sym){
+		return NULL;
+	}
 
-		//関数名取得
-		std::string Callee=Tokens->getCurString();
+	//VARIABLE_IDENTIFIER
+	if(sym->Flags & SYMBOL_VARIABLE){
+		SymbolID var_name=Tokens->getCurSymbol();
 		Tokens->getNextToken();
+		return new(*Arena) VariableAST(var_name);
+	}
 
-		//LEFT PALEN
-		if(Tokens->getCurType()!=TOK_SYMBOL ||
-				Tokens->getCurString()!="("){
-			Tokens->applyTokenIndex(bkup);
-			return NULL;
-		}
+	//FUNCTION_IDENTIFIER
+	int param_num=sym->Arity;
 
-		Tokens->getNextToken();
-		//argument list
-		std::vector<BaseAST*> args;
-		BaseAST *assign_expr=visitAssignmentExpression();
-		if(assign_expr){
-			args.push_back(assign_expr);
-			while(Tokens->getCurType()==TOK_SYMBOL &&
-					Tokens->getCurString()==","){
-				Tokens->getNextToken();
+	//関数名取得
+	SymbolID callee=Tokens->getCurSymbol();
+	Tokens->getNextToken();
 
-				//IDENTIFIER
-				assign_expr=visitAssignmentExpression();
-				if(assign_expr){
-					args.push_back(assign_expr);
-				}else{
-					break;
-				}
-			}//end while
-		}
+	//LEFT PALEN
+	if(Tokens->getCurType()!=TOK_LPAREN){
+		return NULL;
+	}
+	Tokens->getNextToken();
+
+	//argument list(NodeStackのbegin以降に積む)
+	int begin=NodeStack.size();
+	bool is_valid=true;
+	if(Tokens->getCurType()!=TOK_RPAREN){
+		while(true){
+			BaseAST *assign_expr=visitAssignmentExpression();
+			if(!assign_expr){
+				is_valid=false;
+				break;
+			}
+			NodeStack.push_back(assign_expr);
 
-		//引数の数を確認
-		if(args.size() != param_num){
-			for(int i=0;i<args.size();i++)
-				SAFE_DELETE(args[i]);
-			Tokens->applyTokenIndex(bkup);
-			return NULL;
-		}
-			
-		//RIGHT PALEN
-		if(Tokens->getCurType()==TOK_SYMBOL &&
-					Tokens->getCurString()==")"){
-			Tokens->getNextToken();
-			return new CallExprAST(Callee, args);
-		}else{
-			for(int i=0;i<args.size();i++)
-				SAFE_DELETE(args[i]);
-			Tokens->applyTokenIndex(bkup);
-			return NULL;
-		}
+			if(Tokens->getCurType()==TOK_COMMA){
+				Tokens->getNextToken();
+			}else{
+				break;
+			}
+		}//end while
+	}
 
+	//引数の数を確認，RIGHT PALEN
+	if(is_valid && NodeStack.size()-begin == param_num && Tokens->getCurType()==TOK_RPAREN){
+		Tokens->getNextToken();
+		CallExprAST *call_expr=new(*Arena) CallExprAST(*Arena, callee, NodeStack, begin);
+		NodeStack.resize(begin);
+		return call_expr;
 	}else{
 		return NULL;
 	}
@@ -651,59 +771,42 @@ BaseAST *Parser::visitPostfixExpression(){
 
 /**
   * PrimaryExpression用構文解析メソッド
+  * VARIABLE_IDENTIFIERはvisitPostfixExpressionで識別子表を引く際に解析する
   * @return 解析成功時：AST　失敗時：NULL
   */
 BaseAST *Parser::visitPrimaryExpression(){
-	//recored index
-	int bkup=Tokens->getCurIndex();
-
-
-	//VARIABLE_IDENTIFIER
-	if(Tokens->getCurType()==TOK_IDENTIFIER &&
-		(std::find(VariableTable.begin(), VariableTable.end(), Tokens->getCurString()) !=
-		VariableTable.end()) ){
-		std::string var_name=Tokens->getCurString();
-		Tokens->getNextToken();
-		return new VariableAST(var_name);
-
 	//integer
-	}else if(Tokens->getCurType()==TOK_DIGIT){
+	if(Tokens->getCurType()==TOK_DIGIT){
 		int val=Tokens->getCurNumVal();
 		Tokens->getNextToken();
-		return new NumberAST(val);
+		return new(*Arena) NumberAST(val);
 
 	//integer(-)
-	}else if(Tokens->getCurType()==TOK_SYMBOL &&
-			Tokens->getCurString()=="-"){
+	}else if(Tokens->getCurType()==TOK_MINUS){
 		Tokens->getNextToken();
 		if(Tokens->getCurType()==TOK_DIGIT){
 			int val=Tokens->getCurNumVal();
 			Tokens->getNextToken();
-			return new NumberAST(-val);
+			return new(*Arena) NumberAST(-val);
 		}else{
-			Tokens->applyTokenIndex(bkup);
 			return NULL;
 		}
 
 	// '(' expression ')'
-	}else if(Tokens->getCurType()==TOK_SYMBOL &&
-			Tokens->getCurString()=="("){
+	}else if(Tokens->getCurType()==TOK_LPAREN){
 		Tokens->getNextToken();
 
 		//expression
 		BaseAST *assign_expr;
 		if(!(assign_expr=visitAssignmentExpression())){
-			Tokens->applyTokenIndex(bkup);
 			return NULL;
 		}
 
 		//RIGHT PALEN
-		if(Tokens->getCurString()==")"){
+		if(Tokens->getCurType()==TOK_RPAREN){
 			Tokens->getNextToken();
 			return assign_expr;
 		}else{
-			SAFE_DELETE(assign_expr);
-			Tokens->applyTokenIndex(bkup);
 			return NULL;
 		}
 
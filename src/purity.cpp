@@ -0,0 +1,175 @@
+#include "purity.hpp"
+#include<algorithm>
+
+
+/**
+  * 解析実行
+  * 関数ごとの呼び出し先を集め，強連結成分ごとに純粋性と再帰を求める
+  * @param 対象のFlatAST
+  */
+void PurityAnalysis::analyze(FlatAST &ast){
+	AST=&ast;
+	int num_funcs=ast.getFunctionNum();
+	FunctionIndex.clear();
+	for(int i=0; i<num_funcs; i++){
+		SymbolID name=ast.getPrototype(ast.getFunction(i).Proto).Name;
+		if(name>=FunctionIndex.size())
+			FunctionIndex.resize(name+1, -1);
+		FunctionIndex[name]=i;
+	}
+
+	EdgeBegin.clear();
+	Edges.clear();
+	for(int i=0; i<num_funcs; i++){
+		EdgeBegin.push_back(Edges.size());
+		const FlatFunction &func=ast.getFunction(i);
+		for(int j=0; j<func.NumStmts; j++)
+			visitExpression(ast.getStatement(func.StmtBegin+j));
+	}
+	EdgeBegin.push_back(Edges.size());
+
+	findComponents();
+	AST=NULL;
+}
+
+
+/**
+  * 関数が純粋か
+  * @param 関数のシンボルID
+  * @return 純粋：true　純粋でない，またはModule内で定義しない：false
+  */
+bool PurityAnalysis::isPure(SymbolID name){
+	if(name>=FunctionIndex.size() || FunctionIndex[name]<0)
+		return false;
+	return Pure[FunctionIndex[name]];
+}
+
+
+/**
+  * 関数が再帰するか
+  * @param 関数のシンボルID
+  * @return 自身を(他の関数を経由して)呼び出し得る：true　それ以外：false
+  */
+bool PurityAnalysis::isRecursive(SymbolID name){
+	if(name>=FunctionIndex.size() || FunctionIndex[name]<0)
+		return false;
+	return Recursive[FunctionIndex[name]];
+}
+
+
+/**
+  * 関数が関数呼び出しを含むか
+  * @param 関数のシンボルID
+  * @return 含む：true　含まない(葉関数)，またはModule内で定義しない：false
+  */
+bool PurityAnalysis::hasCalls(SymbolID name){
+	if(name>=FunctionIndex.size() || FunctionIndex[name]<0)
+		return false;
+	int func=FunctionIndex[name];
+	return EdgeBegin[func+1]>EdgeBegin[func];
+}
+
+
+/**
+  * 呼び出し先の記録
+  * @param 関数呼び出しの参照，FlatCall
+  */
+int PurityAnalysis::visitCallExpression(FlatRef, const FlatCall &call_expr){
+	SymbolID callee=call_expr.Callee;
+	Edges.push_back(callee<FunctionIndex.size() ? FunctionIndex[callee] : -1);
+	for(int i=0; i<call_expr.NumArgs; i++)
+		visitExpression(AST->getArg(call_expr.ArgBegin+i));
+	return 0;
+}
+
+
+/**
+  * 強連結成分の検出(Tarjanの方法)
+  * 深い呼び出しの連鎖でスタックを溢れさせないよう，深さ優先探索は明示的なスタックで行う．
+  * 強連結成分は呼び出される側から順に確定する
+  */
+void PurityAnalysis::findComponents(){
+	int num_funcs=EdgeBegin.size()-1;
+	std::vector<int> order(num_funcs, -1);		//訪問順(-1：未訪問)
+	std::vector<int> low(num_funcs, 0);
+	std::vector<int> component(num_funcs, -1);	//確定した強連結成分の番号
+	std::vector<int> stack;						//成分が確定していない関数
+	std::vector<int> members;
+	std::vector<std::pair<int, unsigned int> > path;	//探索中の関数と次に辿る辺
+	int counter=0;
+	int num_components=0;
+
+	Pure.assign(num_funcs, 0);
+	Recursive.assign(num_funcs, 0);
+	NumPure=0;
+
+	for(int root=0; root<num_funcs; root++){
+		if(order[root]>=0)
+			continue;
+		order[root]=low[root]=counter++;
+		stack.push_back(root);
+		path.push_back(std::make_pair(root, EdgeBegin[root]));
+
+		while(!path.empty()){
+			int func=path.back().first;
+			if(path.back().second<EdgeBegin[func+1]){
+				int callee=Edges[path.back().second++];
+				if(callee<0)
+					continue;
+				if(order[callee]<0){
+					order[callee]=low[callee]=counter++;
+					stack.push_back(callee);
+					path.push_back(std::make_pair(callee, EdgeBegin[callee]));
+				}else if(component[callee]<0){
+					low[func]=std::min(low[func], order[callee]);
+				}
+				continue;
+			}
+
+			//辺を辿り終えた関数が成分の根なら，スタックの上から根までが1つの成分
+			path.pop_back();
+			if(!path.empty())
+				low[path.back().first]=std::min(low[path.back().first], low[func]);
+			if(low[func]!=order[func])
+				continue;
+			members.clear();
+			int member;
+			do{
+				member=stack.back();
+				stack.pop_back();
+				component[member]=num_components;
+				members.push_back(member);
+			}while(member!=func);
+			classifyComponent(members, component, num_components++);
+		}
+	}
+}
+
+
+/**
+  * 強連結成分の純粋性と再帰の判定
+  * 成分外の呼び出し先は確定済みのため，Module外の関数と純粋でない成分を呼ばなければ純粋
+  * @param 成分の関数，関数ごとの成分の番号，この成分の番号
+  */
+void PurityAnalysis::classifyComponent(const std::vector<int> &members,
+		const std::vector<int> &component, int id){
+	bool pure=true;
+	bool recursive=(members.size()>1);
+	for(int i=0; i<members.size(); i++){
+		int func=members[i];
+		for(unsigned int j=EdgeBegin[func]; j<EdgeBegin[func+1]; j++){
+			int callee=Edges[j];
+			if(callee<0 || (component[callee]!=id && !Pure[callee]))
+				pure=false;
+			if(callee==func)
+				recursive=true;
+		}
+	}
+
+	for(int i=0; i<members.size(); i++){
+		Pure[members[i]]=pure;
+		Recursive[members[i]]=recursive;
+		if(pure)
+			NumPure++;
+	}
+}
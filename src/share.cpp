@@ -0,0 +1,150 @@
+#include "share.hpp"
+
+
+/**
+  * 共有実行
+  * 式のノードを共有しながら作り直し，元のFlatASTの式と入れ替える
+  * (Simplifier等で参照されなくなったノードもここで取り除かれる)
+  * @param 対象のFlatAST
+  */
+void ExpressionSharer::doShare(FlatAST &ast){
+	AST=&ast;
+	size_t before=ast.getMemorySize();
+
+	for(int i=0; i<ast.getFunctionNum(); i++){
+		//コード生成で値を使い回せるのは同じ基本ブロック(関数)の中のみ
+		clearTables();
+		const FlatFunction &func=ast.getFunction(i);
+		for(int j=0; j<func.NumStmts; j++){
+			unsigned int index=func.StmtBegin+j;
+			ast.setStatement(index, visitExpression(ast.getStatement(index)));
+		}
+	}
+
+	ast.swapExpressions(Out, true);
+	Out=FlatAST();
+	clearTables();
+	SavedBytes+=(long)before-(long)ast.getMemorySize();
+	AST=NULL;
+}
+
+
+/**
+  * 共有するノードの表を空にする
+  */
+void ExpressionSharer::clearTables(){
+	Numbers.clear();
+	Variables.clear();
+	for(int i=0; i<=DivOp; i++)
+		Binaries[i].clear();
+}
+
+
+/**
+  * 二項演算の共有
+  * 代入は共有せず，代入先の変数の代入回数を進める
+  * @param 二項演算の参照，FlatBinary
+  * @return 共有後のノードの参照
+  */
+FlatRef ExpressionSharer::visitBinaryExpression(FlatRef, const FlatBinary &bin_expr){
+	BinaryOp op=bin_expr.Op;
+	if(op==AssignOp){
+		SymbolID var=AST->getVariable(bin_expr.LHS);
+		FlatRef rhs=visitExpression(bin_expr.RHS);
+		bool found;
+		FlatRef lhs=getVariableNode(var, found);
+		Generations[var]++;
+		return Out.addBinary(AssignOp, lhs, rhs);
+	}
+
+	FlatRef lhs=visitExpression(bin_expr.LHS);
+	FlatRef rhs=visitExpression(bin_expr.RHS);
+	unsigned long long key=((unsigned long long)lhs<<32) | rhs;
+	llvm::DenseMap<unsigned long long, FlatRef>::iterator it=Binaries[op].find(key);
+	if(it!=Binaries[op].end()){
+		SharedNodes++;
+		SavedInstructions++;
+		return it->second;
+	}
+	FlatRef node=Out.addBinary(op, lhs, rhs);
+	Binaries[op][key]=node;
+	return node;
+}
+
+
+/**
+  * 関数呼び出しの引数の共有(呼び出し自体は共有しない)
+  * @param 関数呼び出しの参照，FlatCall
+  * @return 共有後のノードの参照
+  */
+FlatRef ExpressionSharer::visitCallExpression(FlatRef, const FlatCall &call_expr){
+	int begin=ArgStack.size();
+	for(int i=0; i<call_expr.NumArgs; i++)
+		ArgStack.push_back(visitExpression(AST->getArg(call_expr.ArgBegin+i)));
+	FlatRef node=Out.addCall(call_expr.Callee, ArgStack, begin);
+	ArgStack.resize(begin);
+	return node;
+}
+
+
+/**
+  * ジャンプ文のreturnする式の共有
+  * @param ジャンプ文の参照，returnする式の参照
+  * @return 共有後のノードの参照
+  */
+FlatRef ExpressionSharer::visitJumpStatement(FlatRef, FlatRef expr){
+	return Out.addJump(visitExpression(expr));
+}
+
+
+/**
+  * 変数参照の共有
+  * @param 変数参照の参照，変数のシンボルID
+  * @return 共有後のノードの参照
+  */
+FlatRef ExpressionSharer::visitVariable(FlatRef, SymbolID var){
+	bool found;
+	FlatRef node=getVariableNode(var, found);
+	if(found){
+		SharedNodes++;
+		SavedInstructions++;
+	}
+	return node;
+}
+
+
+/**
+  * 数値の共有(定数のため命令数は変わらない)
+  * @param 数値の参照，値
+  * @return 共有後のノードの参照
+  */
+FlatRef ExpressionSharer::visitNumber(FlatRef, int value){
+	unsigned long long key=(unsigned int)value;
+	llvm::DenseMap<unsigned long long, FlatRef>::iterator it=Numbers.find(key);
+	if(it!=Numbers.end()){
+		SharedNodes++;
+		return it->second;
+	}
+	FlatRef node=Out.addNumber(value);
+	Numbers[key]=node;
+	return node;
+}
+
+
+/**
+  * 現在の代入回数での変数参照のノード取得
+  * @param 変数のシンボルID，既存のノードだったかの格納先
+  * @return 変数参照のノードの参照
+  */
+FlatRef ExpressionSharer::getVariableNode(SymbolID var, bool &found){
+	if(var>=Generations.size())
+		Generations.resize(var+1, 0);
+	unsigned long long key=((unsigned long long)Generations[var]<<32) | var;
+	llvm::DenseMap<unsigned long long, FlatRef>::iterator it=Variables.find(key);
+	found=(it!=Variables.end());
+	if(found)
+		return it->second;
+	FlatRef node=Out.addVariable(var);
+	Variables[key]=node;
+	return node;
+}
@@ -0,0 +1,338 @@
+#include "simplify.hpp"
+#include<climits>
+
+
+/**
+  * 定数項の分離で「定数以外の項が無い」ことを表す参照
+  * (NullExprは二項演算の被演算子にならない)
+  */
+#define NO_TERM FLAT_REF(NullExprID, 0)
+
+
+/**
+  * i32と同じく2の補数で折り返す演算
+  */
+static inline int addWrap(int lhs, int rhs){return (int)((unsigned int)lhs+(unsigned int)rhs);}
+static inline int subWrap(int lhs, int rhs){return (int)((unsigned int)lhs-(unsigned int)rhs);}
+static inline int mulWrap(int lhs, int rhs){return (int)((unsigned int)lhs*(unsigned int)rhs);}
+
+
+/**
+  * 簡約実行
+  * 各関数の文を順に簡約し，減ったノード数を加算する
+  * @param 簡約するFlatAST
+  */
+void Simplifier::doSimplify(FlatAST &ast){
+	AST=&ast;
+	FlatNodeCounter counter(&ast);
+	for(int i=0; i<ast.getFunctionNum(); i++){
+		const FlatFunction &func=ast.getFunction(i);
+		for(int j=0; j<func.NumStmts; j++){
+			unsigned int index=func.StmtBegin+j;
+			FlatRef stmt=ast.getStatement(index);
+			int before=counter.visitExpression(stmt);
+			stmt=visitExpression(stmt);
+			ast.setStatement(index, stmt);
+			RemovedNodes+=before-counter.visitExpression(stmt);
+		}
+	}
+	AST=NULL;
+}
+
+
+/**
+  * 二項演算の簡約
+  * 被演算子を先に簡約し，定数項は右辺に寄せる．
+  * 左結合の長い式で再帰が深くならないよう，左辺の二項演算の連なりは反復で辿り，
+  * 最も内側の演算から順に簡約する
+  * @param 二項演算の参照，FlatBinary
+  * @return 簡約後の式の参照
+  */
+FlatRef Simplifier::visitBinaryExpression(FlatRef ref, const FlatBinary &bin_expr){
+	//assignment (lhs is variable)
+	if(bin_expr.Op==AssignOp){
+		//ノードの追加で配列が再確保されるため先に写す
+		FlatRef lhs=bin_expr.LHS;
+		FlatRef rhs=bin_expr.RHS;
+		AST->setBinary(ref, AssignOp, lhs, visitExpression(rhs));
+		return ref;
+	}
+
+	int spine_begin=SpineStack.size();
+	FlatRef lhs=ref;
+	while(FLAT_ID(lhs)==BinaryExprID && AST->getBinary(lhs).Op!=AssignOp){
+		SpineStack.push_back(lhs);
+		lhs=AST->getBinary(lhs).LHS;
+	}
+	lhs=visitExpression(lhs);
+
+	for(int i=SpineStack.size()-1; i>=spine_begin; i--){
+		FlatRef node=SpineStack[i];
+		//ノードの追加で配列が再確保されるため先に写す
+		FlatBinary bin=AST->getBinary(node);
+		FlatRef rhs=visitExpression(bin.RHS);
+		AST->setBinary(node, bin.Op, lhs, rhs);
+
+		switch(bin.Op){
+			case AddOp:
+			case SubOp:
+				lhs=simplifyAdditive(node, bin.Op, lhs, rhs);
+				break;
+			case MulOp:
+				lhs=simplifyMultiply(node, lhs, rhs);
+				break;
+			case DivOp:
+				lhs=simplifyDivide(node, lhs, rhs);
+				break;
+			default:
+				lhs=node;
+				break;
+		}
+	}
+	SpineStack.resize(spine_begin);
+	return lhs;
+}
+
+
+/**
+  * 関数呼び出しの引数の簡約
+  * @param 関数呼び出しの参照，FlatCall
+  * @return 関数呼び出しの参照
+  */
+FlatRef Simplifier::visitCallExpression(FlatRef ref, const FlatCall &call_expr){
+	unsigned int begin=call_expr.ArgBegin;
+	unsigned int num=call_expr.NumArgs;
+	for(unsigned int i=begin; i<begin+num; i++)
+		AST->setArg(i, visitExpression(AST->getArg(i)));
+	return ref;
+}
+
+
+/**
+  * returnする式の簡約
+  * @param ジャンプ文の参照，returnする式の参照
+  * @return ジャンプ文の参照
+  */
+FlatRef Simplifier::visitJumpStatement(FlatRef ref, FlatRef expr){
+	AST->setJumpExpr(ref, visitExpression(expr));
+	return ref;
+}
+
+
+/**
+  * 加減算の簡約
+  * (x+c1)-(y+c2) -> (x-y)+(c1-c2) のように定数項をまとめ，x+0，x-xを取り除く
+  * @param 二項演算の参照，演算子，簡約済みの左辺，右辺
+  * @return 簡約後の式の参照
+  */
+FlatRef Simplifier::simplifyAdditive(FlatRef ref, BinaryOp op, FlatRef lhs, FlatRef rhs){
+	if(op==SubOp && isSameExpression(lhs, rhs) && isRemovable(lhs))
+		return AST->addNumber(0);
+
+	FlatRef lhs_term, rhs_term;
+	int lhs_value, rhs_value;
+	splitConstant(lhs, AddOp, lhs_term, lhs_value);
+	splitConstant(rhs, AddOp, rhs_term, rhs_value);
+	int value=(op==AddOp) ? addWrap(lhs_value, rhs_value) : subWrap(lhs_value, rhs_value);
+
+	FlatRef term;
+	if(lhs_term==NO_TERM && rhs_term==NO_TERM){
+		return AST->addNumber(value);
+	}else if(rhs_term==NO_TERM){
+		term=lhs_term;
+	}else if(lhs_term==NO_TERM){
+		//c-xは符号を反転したノードが増えるためそのまま
+		if(op==SubOp)
+			return ref;
+		term=rhs_term;
+	}else{
+		term=makeBinary(ref, op, lhs_term, rhs_term);
+	}
+
+	if(value==0)
+		return term;
+	return makeConstantOperation(ref, AddOp, term, value);
+}
+
+
+/**
+  * 乗算の簡約
+  * 定数の係数をまとめ，x*1，x*0を取り除く
+  * @param 二項演算の参照，簡約済みの左辺，右辺
+  * @return 簡約後の式の参照
+  */
+FlatRef Simplifier::simplifyMultiply(FlatRef ref, FlatRef lhs, FlatRef rhs){
+	FlatRef lhs_term, rhs_term;
+	int lhs_value, rhs_value;
+	splitConstant(lhs, MulOp, lhs_term, lhs_value);
+	splitConstant(rhs, MulOp, rhs_term, rhs_value);
+	int value=mulWrap(lhs_value, rhs_value);
+
+	if(lhs_term==NO_TERM && rhs_term==NO_TERM)
+		return AST->addNumber(value);
+
+	//x*0は副作用が無い場合のみ0にする
+	if(value==0 && (lhs_term==NO_TERM || isRemovable(lhs_term)) &&
+			(rhs_term==NO_TERM || isRemovable(rhs_term)))
+		return AST->addNumber(0);
+
+	FlatRef term;
+	if(rhs_term==NO_TERM)
+		term=lhs_term;
+	else if(lhs_term==NO_TERM)
+		term=rhs_term;
+	else
+		term=makeBinary(ref, MulOp, lhs_term, rhs_term);
+
+	if(value==1)
+		return term;
+	return makeConstantOperation(ref, MulOp, term, value);
+}
+
+
+/**
+  * 除算の簡約
+  * 0除算とINT_MIN/-1は実行時の動作を残すため畳み込まない
+  * @param 二項演算の参照，簡約済みの左辺，右辺
+  * @return 簡約後の式の参照
+  */
+FlatRef Simplifier::simplifyDivide(FlatRef ref, FlatRef lhs, FlatRef rhs){
+	if(FLAT_ID(rhs)!=NumberID)
+		return ref;
+	int rhs_value=AST->getNumber(rhs);
+	if(rhs_value==1)
+		return lhs;
+	if(FLAT_ID(lhs)==NumberID && rhs_value!=0){
+		int lhs_value=AST->getNumber(lhs);
+		if(!(lhs_value==INT_MIN && rhs_value==-1))
+			return AST->addNumber(lhs_value/rhs_value);
+	}
+	return ref;
+}
+
+
+/**
+  * 二項演算のノード取得
+  * 元のノードと同じ形であれば新たに追加しない
+  * @param 元の二項演算の参照，演算子，左辺，右辺
+  * @return 二項演算の参照
+  */
+FlatRef Simplifier::makeBinary(FlatRef ref, BinaryOp op, FlatRef lhs, FlatRef rhs){
+	const FlatBinary &bin_expr=AST->getBinary(ref);
+	if(bin_expr.Op==op && bin_expr.LHS==lhs && bin_expr.RHS==rhs)
+		return ref;
+	return AST->addBinary(op, lhs, rhs);
+}
+
+
+/**
+  * 「項 演算子 定数」のノード取得
+  * 負の定数の加算は減算にする．元のノードと同じ形であれば新たに追加しない
+  * @param 元の二項演算の参照，演算子(AddOp/MulOp)，項，定数
+  * @return 二項演算の参照
+  */
+FlatRef Simplifier::makeConstantOperation(FlatRef ref, BinaryOp op, FlatRef term, int value){
+	if(op==AddOp && value<0 && value!=INT_MIN){
+		op=SubOp;
+		value=-value;
+	}
+	const FlatBinary &bin_expr=AST->getBinary(ref);
+	if(bin_expr.Op==op && bin_expr.LHS==term &&
+			FLAT_ID(bin_expr.RHS)==NumberID && AST->getNumber(bin_expr.RHS)==value)
+		return ref;
+	return AST->addBinary(op, term, AST->addNumber(value));
+}
+
+
+/**
+  * 式を「項 演算子 定数」に分ける
+  * 加算(op=AddOp)ではx+c，x-c，cを，乗算(op=MulOp)ではx*c，cを分ける．
+  * 分けられない場合は定数を単位元(0または1)とする
+  * @param 式の参照，演算子，項の格納先(定数のみの場合はNO_TERM)，定数の格納先
+  */
+void Simplifier::splitConstant(FlatRef expr, BinaryOp op, FlatRef &term, int &value){
+	if(FLAT_ID(expr)==NumberID){
+		term=NO_TERM;
+		value=AST->getNumber(expr);
+		return;
+	}
+	term=expr;
+	value=(op==MulOp) ? 1 : 0;
+	if(FLAT_ID(expr)!=BinaryExprID)
+		return;
+
+	const FlatBinary &bin_expr=AST->getBinary(expr);
+	if(FLAT_ID(bin_expr.RHS)!=NumberID)
+		return;
+	int rhs_value=AST->getNumber(bin_expr.RHS);
+	if(op==AddOp && bin_expr.Op==AddOp){
+		term=bin_expr.LHS;
+		value=rhs_value;
+	}else if(op==AddOp && bin_expr.Op==SubOp){
+		term=bin_expr.LHS;
+		value=subWrap(0, rhs_value);
+	}else if(op==MulOp && bin_expr.Op==MulOp){
+		term=bin_expr.LHS;
+		value=rhs_value;
+	}
+}
+
+
+/**
+  * 式を評価しなくても動作が変わらないか
+  * 関数呼び出し，代入，0除算の可能性がある除算を含む場合はfalse．
+  * 左辺の二項演算の連なりは反復で辿り，右辺のみ再帰する
+  * @param 式の参照
+  * @return 取り除ける場合：true
+  */
+bool Simplifier::isRemovable(FlatRef expr){
+	while(FLAT_ID(expr)==BinaryExprID){
+		const FlatBinary &bin_expr=AST->getBinary(expr);
+		if(bin_expr.Op==AssignOp)
+			return false;
+		if(bin_expr.Op==DivOp){
+			if(FLAT_ID(bin_expr.RHS)!=NumberID)
+				return false;
+			int rhs_value=AST->getNumber(bin_expr.RHS);
+			if(rhs_value==0 || rhs_value==-1)
+				return false;
+		}
+		if(!isRemovable(bin_expr.RHS))
+			return false;
+		expr=bin_expr.LHS;
+	}
+	return FLAT_ID(expr)==NumberID || FLAT_ID(expr)==VariableID;
+}
+
+
+/**
+  * 2つの式が同じ形か
+  * 左辺の二項演算の連なりは反復で辿り，右辺のみ再帰する
+  * @param 式の参照
+  * @return 同じ場合：true
+  */
+bool Simplifier::isSameExpression(FlatRef lhs, FlatRef rhs){
+	while(true){
+		if(lhs==rhs)
+			return true;
+		if(FLAT_ID(lhs)!=FLAT_ID(rhs))
+			return false;
+		switch(FLAT_ID(lhs)){
+			case NumberID:
+				return AST->getNumber(lhs)==AST->getNumber(rhs);
+			case VariableID:
+				return AST->getVariable(lhs)==AST->getVariable(rhs);
+			case BinaryExprID:{
+				const FlatBinary &lhs_expr=AST->getBinary(lhs);
+				const FlatBinary &rhs_expr=AST->getBinary(rhs);
+				if(lhs_expr.Op!=rhs_expr.Op || !isSameExpression(lhs_expr.RHS, rhs_expr.RHS))
+					return false;
+				lhs=lhs_expr.LHS;
+				rhs=rhs_expr.LHS;
+				break;
+			}
+			default:
+				return false;
+		}
+	}
+}
@@ -0,0 +1,188 @@
+#include "symbol.hpp"
+#include<cstring>
+
+
+/**
+  * 文字列のハッシュ値(FNV-1a)
+  */
+static inline unsigned int hashString(const char *str, int length){
+	unsigned int hash=2166136261u;
+	for(int i=0; i<length; i++){
+		hash^=(unsigned char)str[i];
+		hash*=16777619u;
+	}
+	return hash;
+}
+
+
+/**
+  * コンストラクタ
+  */
+SymbolInterner::SymbolInterner(){
+	Buckets.assign(256, INVALID_SYMBOL);
+}
+
+
+/**
+  * 文字列に対応するシンボルIDを取得
+  * 初出の文字列には新しいIDを振る
+  * @param 文字列の先頭，長さ
+  * @return シンボルID
+  */
+SymbolID SymbolInterner::intern(const char *str, int length){
+	unsigned int hash=hashString(str, length);
+	unsigned int mask=Buckets.size()-1;
+	for(unsigned int i=hash & mask; ; i=(i+1) & mask){
+		SymbolID id=Buckets[i];
+		if(id==INVALID_SYMBOL){
+			id=Names.size();
+			Names.push_back(std::string(str, length));
+			Hashes.push_back(hash);
+			Buckets[i]=id;
+
+			//使用率が1/2を超えたら拡張
+			if(Names.size()*2 > Buckets.size())
+				grow();
+			return id;
+		}else if(Hashes[id]==hash && Names[id].size()==length &&
+				memcmp(Names[id].data(), str, length)==0){
+			return id;
+		}
+	}
+}
+
+
+/**
+  * ハッシュ表を2倍に拡張
+  */
+void SymbolInterner::grow(){
+	Buckets.assign(Buckets.size()*2, INVALID_SYMBOL);
+	unsigned int mask=Buckets.size()-1;
+	for(SymbolID id=0; id<Names.size(); id++){
+		unsigned int i=Hashes[id] & mask;
+		while(Buckets[i]!=INVALID_SYMBOL)
+			i=(i+1) & mask;
+		Buckets[i]=id;
+	}
+}
+
+
+/**
+  * コンストラクタ
+  * 最外(グローバル)スコープの深さは0
+  */
+ScopedSymbolTable::ScopedSymbolTable(){
+	Keys.assign(64, INVALID_SYMBOL);
+	Tops.assign(64, -1);
+	NumKeys=0;
+}
+
+
+/**
+  * シンボルIDのハッシュ表上の位置
+  * @return idを格納した位置，未登録の場合は空き位置
+  */
+int ScopedSymbolTable::findSlot(SymbolID id){
+	unsigned int mask=Keys.size()-1;
+	unsigned int i=(id*2654435761u) & mask;
+	while(Keys[i]!=id && Keys[i]!=INVALID_SYMBOL)
+		i=(i+1) & mask;
+	return i;
+}
+
+
+/**
+  * 現在のスコープに識別子を登録
+  * 外側のスコープの同名の識別子は隠す
+  * @param シンボルID，SYMBOL_*の組み合わせ，関数の引数の数
+  * @return 成功時：true　現在のスコープに登録済みの場合：false
+  */
+bool ScopedSymbolTable::declare(SymbolID id, unsigned int flags, int arity){
+	int slot=findSlot(id);
+	if(Keys[slot]==INVALID_SYMBOL){
+		Keys[slot]=id;
+		NumKeys++;
+
+		//使用率が1/2を超えたら拡張
+		if(NumKeys*2 > Keys.size()){
+			grow();
+			slot=findSlot(id);
+		}
+	}
+
+	int top=Tops[slot];
+	if(top>=0 && Entries[top].Depth==getDepth())
+		return false;
+
+	ScopedSymbol sym={id, flags, arity, getDepth(), top};
+	Entries.push_back(sym);
+	Tops[slot]=Entries.size()-1;
+	return true;
+}
+
+
+/**
+  * 現在のスコープを抜ける
+  * スコープ内で登録した識別子を取り除き，隠していた識別子を戻す
+  */
+void ScopedSymbolTable::popScope(){
+	int mark=ScopeMarks.back();
+	ScopeMarks.pop_back();
+	while(Entries.size()>mark){
+		Tops[findSlot(Entries.back().Symbol)]=Entries.back().Shadowed;
+		Entries.pop_back();
+	}
+}
+
+
+/**
+  * ハッシュ表を2倍に拡張
+  * キーは削除しないため，空き位置のみを探して再配置する
+  */
+void ScopedSymbolTable::grow(){
+	std::vector<SymbolID> old_keys(Keys);
+	std::vector<int> old_tops(Tops);
+	Keys.assign(Keys.size()*2, INVALID_SYMBOL);
+	Tops.assign(Tops.size()*2, -1);
+	for(int i=0; i<old_keys.size(); i++){
+		if(old_keys[i]==INVALID_SYMBOL)
+			continue;
+		int slot=findSlot(old_keys[i]);
+		Keys[slot]=old_keys[i];
+		Tops[slot]=old_tops[i];
+	}
+}
+
+
+/**
+  * 全体で共有するSymbolInterner
+  */
+SymbolInterner &getInterner(){
+	static SymbolInterner interner;
+	return interner;
+}
+
+
+/**
+  * 文字列をシンボルIDに変換
+  */
+SymbolID internSymbol(const char *str, int length){
+	return getInterner().intern(str, length);
+}
+
+SymbolID internSymbol(const std::string &str){
+	return getInterner().intern(str.data(), str.size());
+}
+
+
+/**
+  * シンボルIDを文字列に変換
+  * 無効なID(INVALID_SYMBOL等)は空文字列
+  */
+const std::string &getSymbolName(SymbolID id){
+	static const std::string empty;
+	SymbolInterner &interner=getInterner();
+	if(id>=(SymbolID)interner.size())
+		return empty;
+	return interner.getName(id);
+}